@@ -15,12 +15,607 @@
  *	2. Specify the scaling factors for resizing (for both width and height)
  *		Use fx and fy arguments to specify the scaling factor for horizontal and vertical axis respectively (It should be float).
  *		The output size is calculated as cv::Size(cv::round(fx*src.cols), cv::round(fy*src.rows))
+ *
+ * Resizing many frames to the same size:
+ * cv::resize computes interpolation coefficients (which source pixels and with what weights are used for every
+ * destination pixel) on each call. In a video pipeline every frame is resized from the same size to the same size,
+ * so this setup work is repeated for nothing. CachedResizer computes the separable tables once per
+ * (source size, destination size, interpolation, channels) and reuses them. It also has dedicated SIMD paths for the
+ * most common cases which need no tables at all:
+ *	- exact 2x and 4x downscale with cv::INTER_AREA (average of 2x2 or 4x4 blocks),
+ *	- exact 2x upscale with cv::INTER_LINEAR (weights 3/4 and 1/4 in both directions).
+ * 8-bit images with cv::INTER_NEAREST and cv::INTER_LINEAR use cached tables, everything else goes to cv::resize.
  */
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
+#include <vector>
+
+
+// Fixed point precision of linear interpolation weights (the same as used by OpenCV)
+constexpr int RESIZE_COEF_BITS{ 11 };
+constexpr int RESIZE_COEF_SCALE{ 1 << RESIZE_COEF_BITS };
+
+// Precomputed tables of a separable resize. Offsets are in bytes (pixel index * channels)
+struct ResizeTables
+{
+	std::vector<int> xofs0, xofs1;   // the two source columns used by every destination column
+	std::vector<short> alpha0, alpha1; // and their weights
+	std::vector<int> yofs0, yofs1;   // the two source rows used by every destination row
+	std::vector<short> beta0, beta1; // and their weights
+};
+
+/**
+ * \brief Compute source positions and weights along one axis.
+ * \param srcSize Size of the source along the axis.
+ * \param dstSize Size of the destination along the axis.
+ * \param interpolation cv::INTER_NEAREST or cv::INTER_LINEAR.
+ * \param step Multiplier of the offsets (channels for x, 1 for y).
+ * \param ofs0 Output first source position.
+ * \param ofs1 Output second source position.
+ * \param w0 Output weight of the first position.
+ * \param w1 Output weight of the second position.
+ */
+void computeAxisTables(int srcSize, int dstSize, int interpolation, int step,
+	std::vector<int>& ofs0, std::vector<int>& ofs1, std::vector<short>& w0, std::vector<short>& w1)
+{
+	ofs0.resize(dstSize);
+	ofs1.resize(dstSize);
+	w0.resize(dstSize);
+	w1.resize(dstSize);
+
+	const double scale{ static_cast<double>(srcSize) / dstSize };
+
+	for (int d{ 0 }; d < dstSize; ++d)
+	{
+		int s0, s1;
+		double f;
+
+		if (interpolation == cv::INTER_NEAREST)
+		{
+			s0 = std::min(static_cast<int>(std::floor(d * scale)), srcSize - 1);
+			s1 = s0;
+			f = 0;
+		}
+		else
+		{
+			// Pixel centers are aligned, like in cv::resize
+			double fs{ (d + 0.5) * scale - 0.5 };
+			s0 = static_cast<int>(std::floor(fs));
+			f = fs - s0;
+
+			if (s0 < 0)
+			{
+				s0 = 0;
+				f = 0;
+			}
+			if (s0 >= srcSize - 1)
+			{
+				s0 = srcSize - 1;
+				f = 0;
+			}
+			s1 = std::min(s0 + 1, srcSize - 1);
+		}
+
+		short b{ static_cast<short>(cvRound(f * RESIZE_COEF_SCALE)) };
+		ofs0[d] = s0 * step;
+		ofs1[d] = s1 * step;
+		w0[d] = static_cast<short>(RESIZE_COEF_SCALE - b);
+		w1[d] = b;
+	}
+}
+
+// Loading and storing 16 pixels as separate channel vectors
+template<int cn>
+inline void loadChannels(const uchar* p, cv::v_uint8x16 (&v)[cn])
+{
+	if constexpr (cn == 1)
+		v[0] = cv::v_load(p);
+	else if constexpr (cn == 3)
+		cv::v_load_deinterleave(p, v[0], v[1], v[2]);
+	else
+		cv::v_load_deinterleave(p, v[0], v[1], v[2], v[3]);
+}
+
+template<int cn>
+inline void storeChannels(uchar* p, const cv::v_uint8x16 (&v)[cn])
+{
+	if constexpr (cn == 1)
+		cv::v_store(p, v[0]);
+	else if constexpr (cn == 3)
+		cv::v_store_interleave(p, v[0], v[1], v[2]);
+	else
+		cv::v_store_interleave(p, v[0], v[1], v[2], v[3]);
+}
+
+#if CV_SIMD128
+// Sums of neighbouring lanes: 16 x 8-bit -> 8 x 16-bit. A pair of bytes is one 16-bit lane, so we add its two halves
+inline cv::v_uint16x8 pairSum(const cv::v_uint8x16& v)
+{
+	cv::v_uint16x8 w{ cv::v_reinterpret_as_u16(v) };
+	return (w & cv::v_setall_u16(0xFF)) + (w >> 8);
+}
+
+// The same for 8 x 16-bit -> 4 x 32-bit
+inline cv::v_uint32x4 pairSum(const cv::v_uint16x8& v)
+{
+	cv::v_uint32x4 w{ cv::v_reinterpret_as_u32(v) };
+	return (w & cv::v_setall_u32(0xFFFF)) + (w >> 16);
+}
+#endif
+
+/**
+ * \brief One destination row of 2x area downscale: average of 2x2 blocks.
+ * \param r0 First source row.
+ * \param r1 Second source row.
+ * \param dst Destination row.
+ * \param width Width of the destination row (in pixels).
+ */
+template<int cn>
+void areaDown2Row(const uchar* r0, const uchar* r1, uchar* dst, int width)
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint16x8 two{ cv::v_setall_u16(2) };
+
+	// 16 destination pixels from 32 source pixels of each row
+	for (; x <= width - 16; x += 16)
+	{
+		const int s{ 2 * x * cn };
+		cv::v_uint8x16 a0[cn], a1[cn], b0[cn], b1[cn], out[cn];
+		loadChannels<cn>(r0 + s, a0);
+		loadChannels<cn>(r0 + s + 16 * cn, a1);
+		loadChannels<cn>(r1 + s, b0);
+		loadChannels<cn>(r1 + s + 16 * cn, b1);
+
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			cv::v_uint16x8 low{ pairSum(a0[c]) + pairSum(b0[c]) };
+			cv::v_uint16x8 high{ pairSum(a1[c]) + pairSum(b1[c]) };
+			out[c] = cv::v_pack((low + two) >> 2, (high + two) >> 2);
+		}
+
+		storeChannels<cn>(dst + x * cn, out);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			int s{ 2 * x * cn + c };
+			dst[x * cn + c] = static_cast<uchar>((r0[s] + r0[s + cn] + r1[s] + r1[s + cn] + 2) >> 2);
+		}
+	}
+}
+
+/**
+ * \brief One destination row of 4x area downscale: average of 4x4 blocks.
+ * \param r Four source rows.
+ * \param dst Destination row.
+ * \param width Width of the destination row (in pixels).
+ */
+template<int cn>
+void areaDown4Row(const uchar* const (&r)[4], uchar* dst, int width)
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint32x4 eight{ cv::v_setall_u32(8) };
+
+	// 16 destination pixels from 64 source pixels of each row, in four chunks of 16 source pixels
+	for (; x <= width - 16; x += 16)
+	{
+		cv::v_uint32x4 sums[cn][4];
+
+		for (int k{ 0 }; k < 4; ++k)
+		{
+			const int s{ (4 * x + 16 * k) * cn };
+			cv::v_uint16x8 rowSums[cn];
+
+			for (int row{ 0 }; row < 4; ++row)
+			{
+				cv::v_uint8x16 v[cn];
+				loadChannels<cn>(r[row] + s, v);
+
+				for (int c{ 0 }; c < cn; ++c)
+					rowSums[c] = row == 0 ? pairSum(v[c]) : rowSums[c] + pairSum(v[c]);
+			}
+
+			for (int c{ 0 }; c < cn; ++c)
+				sums[c][k] = (pairSum(rowSums[c]) + eight) >> 4;
+		}
+
+		cv::v_uint8x16 out[cn];
+		for (int c{ 0 }; c < cn; ++c)
+			out[c] = cv::v_pack(cv::v_pack(sums[c][0], sums[c][1]), cv::v_pack(sums[c][2], sums[c][3]));
+
+		storeChannels<cn>(dst + x * cn, out);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			int sum{ 0 };
+			for (int row{ 0 }; row < 4; ++row)
+				for (int i{ 0 }; i < 4; ++i)
+					sum += r[row][(4 * x + i) * cn + c];
+
+			dst[x * cn + c] = static_cast<uchar>((sum + 8) >> 4);
+		}
+	}
+}
+
+/**
+ * \brief One destination row of 2x linear upscale. Every destination pixel is 3/4 of the nearest source pixel and 1/4
+ * of its neighbour in both directions: (9 * a + 3 * b + 3 * c + d + 8) / 16.
+ * \param nearRow Source row closer to the destination row (weight 3/4).
+ * \param farRow The other source row (weight 1/4).
+ * \param dst Destination row.
+ * \param srcWidth Width of the source rows (in pixels), the destination is twice as wide.
+ */
+template<int cn>
+void linearUp2Row(const uchar* nearRow, const uchar* farRow, uchar* dst, int srcWidth)
+{
+	// Single source pixel i, neighbours are clamped at the borders
+	auto pixel = [&](int i)
+	{
+		int prev{ std::max(i - 1, 0) * cn };
+		int next{ std::min(i + 1, srcWidth - 1) * cn };
+
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			int cur{ i * cn + c };
+			int nearEven{ 3 * nearRow[cur] + nearRow[prev + c] };
+			int nearOdd{ 3 * nearRow[cur] + nearRow[next + c] };
+			int farEven{ 3 * farRow[cur] + farRow[prev + c] };
+			int farOdd{ 3 * farRow[cur] + farRow[next + c] };
+
+			dst[2 * i * cn + c] = static_cast<uchar>((3 * nearEven + farEven + 8) >> 4);
+			dst[(2 * i + 1) * cn + c] = static_cast<uchar>((3 * nearOdd + farOdd + 8) >> 4);
+		}
+	};
+
+	if (srcWidth <= 0)
+		return;
+
+	pixel(0);
+	int i{ 1 };
+
+#if CV_SIMD128
+	const cv::v_uint16x8 eight{ cv::v_setall_u16(8) };
+
+	// Horizontal part for 8 pixels: 3 * current + neighbour
+	auto horizontal = [](const cv::v_uint16x8& cur, const cv::v_uint16x8& neighbour)
+	{
+		return (cur << 1) + cur + neighbour;
+	};
+
+	// 16 source pixels (32 destination pixels) per iteration, i + 16 must still be inside the row
+	for (; i <= srcWidth - 17; i += 16)
+	{
+		cv::v_uint8x16 nc[cn], np[cn], nn[cn], fc[cn], fp[cn], fn[cn];
+		loadChannels<cn>(nearRow + i * cn, nc);
+		loadChannels<cn>(nearRow + (i - 1) * cn, np);
+		loadChannels<cn>(nearRow + (i + 1) * cn, nn);
+		loadChannels<cn>(farRow + i * cn, fc);
+		loadChannels<cn>(farRow + (i - 1) * cn, fp);
+		loadChannels<cn>(farRow + (i + 1) * cn, fn);
+
+		cv::v_uint8x16 out0[cn], out1[cn];
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			cv::v_uint16x8 cur[2], prev[2], next[2], fcur[2], fprev[2], fnext[2];
+			cv::v_expand(nc[c], cur[0], cur[1]);
+			cv::v_expand(np[c], prev[0], prev[1]);
+			cv::v_expand(nn[c], next[0], next[1]);
+			cv::v_expand(fc[c], fcur[0], fcur[1]);
+			cv::v_expand(fp[c], fprev[0], fprev[1]);
+			cv::v_expand(fn[c], fnext[0], fnext[1]);
+
+			cv::v_uint16x8 even[2], odd[2];
+			for (int h{ 0 }; h < 2; ++h)
+			{
+				cv::v_uint16x8 nearEven{ horizontal(cur[h], prev[h]) };
+				cv::v_uint16x8 nearOdd{ horizontal(cur[h], next[h]) };
+				cv::v_uint16x8 farEven{ horizontal(fcur[h], fprev[h]) };
+				cv::v_uint16x8 farOdd{ horizontal(fcur[h], fnext[h]) };
+
+				even[h] = ((nearEven << 1) + nearEven + farEven + eight) >> 4;
+				odd[h] = ((nearOdd << 1) + nearOdd + farOdd + eight) >> 4;
+			}
+
+			// Interleave even and odd destination pixels
+			cv::v_zip(cv::v_pack(even[0], even[1]), cv::v_pack(odd[0], odd[1]), out0[c], out1[c]);
+		}
+
+		storeChannels<cn>(dst + 2 * i * cn, out0);
+		storeChannels<cn>(dst + (2 * i + 16) * cn, out1);
+	}
+#endif
+
+	for (; i < srcWidth; ++i)
+		pixel(i);
+}
+
+/**
+ * Resize object which keeps interpolation tables between calls.
+ * Use one instance for a stream of images, eg. frames of a video which are resized to the same size every time.
+ * It is thread safe, the tables are shared between calls. Only the most recently used table sets are kept (LRU), so
+ * a stream of varying sizes does not grow the cache without limit.
+ */
+class CachedResizer
+{
+public:
+	/**
+	 * \param capacity Maximum number of cached table sets.
+	 */
+	explicit CachedResizer(size_t capacity = 8)
+		: capacity_(std::max<size_t>(1, capacity))
+	{}
+
+	/**
+	 * \brief Resize an image, same interface as cv::resize.
+	 * \param src Input image.
+	 * \param dst Output image, allocated if needed (must not be the same cv::Mat as src).
+	 * \param dsize Output size. If empty it is computed from fx and fy.
+	 * \param fx Scale factor along the horizontal axis.
+	 * \param fy Scale factor along the vertical axis.
+	 * \param interpolation Interpolation method.
+	 */
+	void resize(const cv::Mat& src, cv::Mat& dst, cv::Size dsize, double fx = 0, double fy = 0, int interpolation = cv::INTER_LINEAR)
+	{
+		CV_Assert(!src.empty());
+
+		if (dsize.empty())
+			dsize = cv::Size(cvRound(src.cols * fx), cvRound(src.rows * fy));
+		CV_Assert(dsize.width > 0 and dsize.height > 0);
+
+		const int cn{ src.channels() };
+		const bool fastChannels{ src.depth() == CV_8U and (cn == 1 or cn == 3 or cn == 4) };
+
+		// Same size, nothing to interpolate
+		if (dsize == src.size())
+		{
+			src.copyTo(dst);
+			return;
+		}
+
+		dst.create(dsize, src.type());
+
+		// Dedicated paths without tables
+		if (fastChannels and interpolation == cv::INTER_AREA and src.cols == 2 * dsize.width and src.rows == 2 * dsize.height)
+		{
+			runRows(dst.rows, [&](int y)
+			{
+				dispatch(cn, [&](auto channels)
+				{
+					areaDown2Row<decltype(channels)::value>(src.ptr<uchar>(2 * y), src.ptr<uchar>(2 * y + 1), dst.ptr<uchar>(y), dst.cols);
+				});
+			});
+			return;
+		}
+
+		if (fastChannels and interpolation == cv::INTER_AREA and src.cols == 4 * dsize.width and src.rows == 4 * dsize.height)
+		{
+			runRows(dst.rows, [&](int y)
+			{
+				const uchar* const rows[4]{ src.ptr<uchar>(4 * y), src.ptr<uchar>(4 * y + 1), src.ptr<uchar>(4 * y + 2), src.ptr<uchar>(4 * y + 3) };
+				dispatch(cn, [&](auto channels)
+				{
+					areaDown4Row<decltype(channels)::value>(rows, dst.ptr<uchar>(y), dst.cols);
+				});
+			});
+			return;
+		}
+
+		if (fastChannels and interpolation == cv::INTER_LINEAR and dsize.width == 2 * src.cols and dsize.height == 2 * src.rows)
+		{
+			runRows(dst.rows, [&](int y)
+			{
+				// Even destination rows lie above the source row center, odd rows below it
+				int nearest{ y / 2 };
+				int other{ y % 2 == 0 ? std::max(nearest - 1, 0) : std::min(nearest + 1, src.rows - 1) };
+				dispatch(cn, [&](auto channels)
+				{
+					linearUp2Row<decltype(channels)::value>(src.ptr<uchar>(nearest), src.ptr<uchar>(other), dst.ptr<uchar>(y), src.cols);
+				});
+			});
+			return;
+		}
+
+		// Cached tables
+		if (src.depth() == CV_8U and (interpolation == cv::INTER_NEAREST or interpolation == cv::INTER_LINEAR))
+		{
+			std::shared_ptr<const ResizeTables> tables{ getTables(src.size(), dsize, interpolation, cn) };
+
+			if (interpolation == cv::INTER_NEAREST)
+				resizeNearest(src, dst, *tables);
+			else
+				resizeLinear(src, dst, *tables);
+			return;
+		}
+
+		// Everything else
+		cv::resize(src, dst, dsize, 0, 0, interpolation);
+	}
+
+	/**
+	 * \brief Number of cached table sets.
+	 */
+	size_t cachedTables() const
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		return tables_.size();
+	}
+
+private:
+	using Key = std::tuple<int, int, int, int, int, int>; // src width, src height, dst width, dst height, interpolation, channels
+
+	// Run the row function in parallel over destination rows
+	template<typename RowFunc>
+	static void runRows(int rows, RowFunc&& rowFunc)
+	{
+		cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
+		{
+			for (int y{ range.start }; y < range.end; ++y)
+				rowFunc(y);
+		});
+	}
+
+	// Call the function with the number of channels as a compile time constant
+	template<typename Func>
+	static void dispatch(int cn, Func&& func)
+	{
+		switch (cn)
+		{
+		case 1: func(std::integral_constant<int, 1>()); break;
+		case 3: func(std::integral_constant<int, 3>()); break;
+		default: func(std::integral_constant<int, 4>()); break;
+		}
+	}
+
+	std::shared_ptr<const ResizeTables> getTables(cv::Size srcSize, cv::Size dstSize, int interpolation, int cn)
+	{
+		Key key{ srcSize.width, srcSize.height, dstSize.width, dstSize.height, interpolation, cn };
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+
+		for (auto it{ tables_.begin() }; it != tables_.end(); ++it)
+		{
+			if (it->first == key)
+			{
+				// Move to the front (most recently used)
+				tables_.splice(tables_.begin(), tables_, it);
+				return it->second;
+			}
+		}
+
+		auto tables{ std::make_shared<ResizeTables>() };
+		computeAxisTables(srcSize.width, dstSize.width, interpolation, cn, tables->xofs0, tables->xofs1, tables->alpha0, tables->alpha1);
+		computeAxisTables(srcSize.height, dstSize.height, interpolation, 1, tables->yofs0, tables->yofs1, tables->beta0, tables->beta1);
+
+		tables_.emplace_front(key, tables);
+		if (tables_.size() > capacity_)
+			tables_.pop_back();
+
+		return tables;
+	}
+
+	static void resizeNearest(const cv::Mat& src, cv::Mat& dst, const ResizeTables& tab)
+	{
+		const int cn{ src.channels() };
+
+		runRows(dst.rows, [&](int y)
+		{
+			const uchar* s{ src.ptr<uchar>(tab.yofs0[y]) };
+			uchar* d{ dst.ptr<uchar>(y) };
+
+			for (int x{ 0 }; x < dst.cols; ++x)
+				for (int c{ 0 }; c < cn; ++c)
+					d[x * cn + c] = s[tab.xofs0[x] + c];
+		});
+	}
+
+	static void resizeLinear(const cv::Mat& src, cv::Mat& dst, const ResizeTables& tab)
+	{
+		const int cn{ src.channels() };
+		const int rowLength{ dst.cols * cn };
+
+		cv::parallel_for_(cv::Range(0, dst.rows), [&](const cv::Range& range)
+		{
+			// Horizontally interpolated source rows. When upscaling, neighbouring destination rows use the same
+			// source rows, so the last two are kept
+			std::vector<int> buffers[2]{ std::vector<int>(rowLength), std::vector<int>(rowLength) };
+			int bufferRow[2]{ -1, -1 };
+
+			// Horizontally interpolated row sy, the buffer with row keep is not overwritten
+			auto horizontalRow = [&](int sy, int keep) -> const int*
+			{
+				for (int b{ 0 }; b < 2; ++b)
+					if (bufferRow[b] == sy)
+						return buffers[b].data();
+
+				int b{ bufferRow[0] == keep ? 1 : 0 };
+
+				const uchar* s{ src.ptr<uchar>(sy) };
+				int* h{ buffers[b].data() };
+				for (int x{ 0 }; x < dst.cols; ++x)
+				{
+					const uchar* p0{ s + tab.xofs0[x] };
+					const uchar* p1{ s + tab.xofs1[x] };
+					for (int c{ 0 }; c < cn; ++c)
+						h[x * cn + c] = p0[c] * tab.alpha0[x] + p1[c] * tab.alpha1[x];
+				}
+
+				bufferRow[b] = sy;
+				return h;
+			};
+
+			for (int y{ range.start }; y < range.end; ++y)
+			{
+				const int* h0{ horizontalRow(tab.yofs0[y], tab.yofs1[y]) };
+				const int* h1{ horizontalRow(tab.yofs1[y], tab.yofs0[y]) };
+				const int b0{ tab.beta0[y] };
+				const int b1{ tab.beta1[y] };
+				uchar* d{ dst.ptr<uchar>(y) };
+
+				int i{ 0 };
+#if CV_SIMD128
+				const cv::v_int32x4 vb0{ cv::v_setall_s32(b0) };
+				const cv::v_int32x4 vb1{ cv::v_setall_s32(b1) };
+				const cv::v_int32x4 round{ cv::v_setall_s32(1 << (2 * RESIZE_COEF_BITS - 1)) };
+
+				for (; i <= rowLength - 16; i += 16)
+				{
+					cv::v_int32x4 r[4];
+					for (int k{ 0 }; k < 4; ++k)
+						r[k] = (cv::v_load(h0 + i + 4 * k) * vb0 + cv::v_load(h1 + i + 4 * k) * vb1 + round) >> (2 * RESIZE_COEF_BITS);
+
+					cv::v_store(d + i, cv::v_pack_u(cv::v_pack(r[0], r[1]), cv::v_pack(r[2], r[3])));
+				}
+#endif
+				for (; i < rowLength; ++i)
+					d[i] = static_cast<uchar>((h0[i] * b0 + h1[i] * b1 + (1 << (2 * RESIZE_COEF_BITS - 1))) >> (2 * RESIZE_COEF_BITS));
+			}
+		});
+	}
+
+	const size_t capacity_;
+	mutable std::mutex mutex_;
+	std::list<std::pair<Key, std::shared_ptr<const ResizeTables>>> tables_; // LRU, the most recently used at the front
+};
+
+/**
+ * \brief Average time of resizing the image many times.
+ * \param resizeFunc Function which does one resize.
+ * \param iterations Number of calls.
+ * \return Average time of one call in microseconds.
+ */
+template<typename ResizeFunc>
+double averageMicroseconds(ResizeFunc&& resizeFunc, int iterations = 100)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i{ 0 }; i < iterations; ++i)
+		resizeFunc();
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::micro>(stop - start).count() / iterations;
+}
 
 int main()
 {
@@ -77,6 +672,41 @@ int main()
 	cv::imwrite("scaled_down.png", scale_down);
 	cv::imwrite("scaled_up.png", scaled_up);
 
+	// Resizing the same image many times (like frames of a video) with CachedResizer
+	CachedResizer resizer;
+	cv::Mat fast, reference;
+
+	struct ResizeCase
+	{
+		std::string name;
+		cv::Size size;
+		int interpolation;
+	};
+
+	const std::vector<ResizeCase> cases
+	{
+		{ "Area 1/2", cv::Size(boy.cols / 2, boy.rows / 2), cv::INTER_AREA },
+		{ "Area 1/4", cv::Size(boy.cols / 4, boy.rows / 4), cv::INTER_AREA },
+		{ "Linear 2x", cv::Size(boy.cols * 2, boy.rows * 2), cv::INTER_LINEAR },
+		{ "Linear 0.6", cv::Size(cvRound(boy.cols * 0.6), cvRound(boy.rows * 0.6)), cv::INTER_LINEAR },
+		{ "Nearest 1.5", cv::Size(cvRound(boy.cols * 1.5), cvRound(boy.rows * 1.5)), cv::INTER_NEAREST },
+	};
+
+	for (const auto& c : cases)
+	{
+		// The area paths need exact multiples of the size
+		cv::Mat input{ boy(cv::Rect(0, 0, boy.cols - boy.cols % 4, boy.rows - boy.rows % 4)) };
+		cv::Size size{ c.interpolation == cv::INTER_AREA ? cv::Size(input.cols * c.size.width / boy.cols, input.rows * c.size.height / boy.rows) : c.size };
+
+		double opencvTime{ averageMicroseconds([&] { cv::resize(input, reference, size, 0, 0, c.interpolation); }) };
+		double cachedTime{ averageMicroseconds([&] { resizer.resize(input, fast, size, 0, 0, c.interpolation); }) };
+
+		std::cout << c.name << ": cv::resize " << opencvTime << " us, CachedResizer " << cachedTime
+			<< " us, max difference: " << cv::norm(fast, reference, cv::NORM_INF) << std::endl;
+	}
+
+	std::cout << "Cached tables: " << resizer.cachedTables() << std::endl;
+
 
 
 
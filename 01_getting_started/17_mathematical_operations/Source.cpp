@@ -3,6 +3,78 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+
+/**
+ * \brief Histogram of all channels of an 8-bit image, computed in parallel.
+ * \param img Input image with depth CV_8U.
+ * \return Number of occurrences of every value.
+ */
+std::array<int, 256> histogram8U(const cv::Mat& img)
+{
+	std::array<int, 256> hist{};
+	std::mutex mutex;
+	const int rowLength{ img.cols * img.channels() };
+
+	cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range& range)
+	{
+		std::array<int, 256> local{};
+		for (int y{ range.start }; y < range.end; ++y)
+		{
+			const uchar* p{ img.ptr<uchar>(y) };
+			for (int i{ 0 }; i < rowLength; ++i)
+				++local[p[i]];
+		}
+
+		std::lock_guard<std::mutex> lock{ mutex };
+		for (int i{ 0 }; i < 256; ++i)
+			hist[i] += local[i];
+	}, std::max(1.0, img.total() * img.elemSize() / 65536.0));
+
+	return hist;
+}
+
+/**
+ * \brief Brightness and contrast adjustment without leaving 8 bits: dst = saturate(alpha * src + beta).
+ * Every 8-bit input has only 256 possible values, so the result of the formula is precomputed into a table and the image
+ * is processed in a single cv::LUT pass. There is no float copy of the image and src and dst can be the same cv::Mat.
+ * \param src Input image with depth CV_8U (any number of channels).
+ * \param dst Output image.
+ * \param alpha Contrast (scale factor).
+ * \param beta Brightness (offset in the [0, 255] range).
+ * \param autoNormalize If true the result is divided by its maximum, the same normalization as the float version
+ * does with cv::minMaxLoc(). The maximum is taken from one histogram pass over src.
+ */
+void brightnessContrast(const cv::Mat& src, cv::Mat& dst, double alpha, double beta, bool autoNormalize = false)
+{
+	CV_Assert(src.depth() == CV_8U);
+
+	double scale{ 1 };
+	if (autoNormalize)
+	{
+		std::array<int, 256> hist{ histogram8U(src) };
+
+		// Largest output of the values present in the image
+		double maxOut{ 0 };
+		for (int i{ 0 }; i < 256; ++i)
+			if (hist[i] > 0)
+				maxOut = std::max(maxOut, alpha * i + beta);
+
+		if (maxOut > 0)
+			scale = 255.0 / maxOut;
+	}
+
+	cv::Mat lut(1, 256, CV_8U);
+	for (int i{ 0 }; i < 256; ++i)
+		lut.at<uchar>(i) = cv::saturate_cast<uchar>((alpha * i + beta) * scale);
+
+	cv::LUT(src, lut, dst);
+}
 
 
 int main()
@@ -111,6 +183,38 @@ int main()
 	cv::waitKey(0);
 	cv::destroyAllWindows();
 
+	/*
+	 * All of the above converts the image to 32 bit float, which is 4 times bigger than the original, and then walks
+	 * over it several times (split, add, merge, minMaxLoc, divide). For 8-bit images the same result can be
+	 * computed with a 256 entry lookup table in one pass, see brightnessContrast().
+	 */
+	cv::Mat adjusted;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	brightnessContrast(boy, adjusted, 1 + contrast_percentage / 100.0, 0);
+	auto stop = std::chrono::high_resolution_clock::now();
+	std::cout << "8-bit contrast: " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+
+	// Compare with the float version converted back to 8 bits
+	cv::Mat reference;
+	hight_contrast.convertTo(reference, CV_8U, 255);
+	std::cout << "Max difference to float contrast: " << cv::norm(adjusted, reference, cv::NORM_INF) << std::endl;
+
+	// Brightness with normalization, in place
+	cv::Mat normalized{ boy.clone() };
+	start = std::chrono::high_resolution_clock::now();
+	brightnessContrast(normalized, normalized, 1, brightness_offset, true);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "8-bit normalized brightness: " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+
+	bright_normalized_32F.convertTo(reference, CV_8U, 255);
+	std::cout << "Max difference to float normalized brightness: " << cv::norm(normalized, reference, cv::NORM_INF) << std::endl;
+
+	cv::imshow("8-bit contrast", adjusted);
+	cv::imshow("8-bit normalized brightness", normalized);
+	cv::waitKey(0);
+	cv::destroyAllWindows();
+
 
 	return 0;
 }
\ No newline at end of file
@@ -7,15 +7,482 @@
  *	4. Multiply the negative of Mask with the eye region to create a hole in the eye region for the sunglasses to be placed.
  *	5. Add the masked sunglasses and eye region to get the combined eye region with the sunglasses.
  *	6. Replace the eye region in the original image with that of the output we got in the previous step.
+ *
+ * Video mode (run the program with a path to a video file or a camera index, eg. "Source 0"):
+ * Haar cascade detection is far too slow to run on every frame of a 1080p stream. Faces move only a little from one
+ * frame to the next, so FaceTracker runs the full detection only every N frames (or when tracking is lost). In between
+ * it finds the face again with template matching in a small window around its last position, on a downscaled gray
+ * frame. The sunglasses are blended with overlayBGRA (the single-pass version from the previous lesson).
+ * At the end the program reports how many detections were skipped and the per-frame latency.
+ *
+ * Many faces:
+ * Every detected face gets its own sunglasses and the faces are processed in parallel. The sunglasses image is never
+ * resized from the full resolution per face: OverlayCache keeps a mip pyramid (1, 1/2, 1/4, ...) of the image and
+ * a small LRU list of exact sizes which were used recently.
  */
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include "opencv2/objdetect.hpp"
 #include "opencv2/highgui.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
-int main()
+
+// Single-pass BGRA overlay blending, the same as in 19_application_sunglesses_filter_better_verison
+
+/**
+ * \brief Exact division by 255 with rounding for x in [0, 255 * 255].
+ */
+inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 div255(const cv::v_uint16x8& x)
+{
+	cv::v_uint16x8 t{ cv::v_add_wrap(x, cv::v_setall_u16(128)) };
+	return cv::v_shr<8>(cv::v_add_wrap(t, cv::v_shr<8>(t)));
+}
+#endif
+
+/**
+ * \brief Blend one row of BGRA overlay pixels into BGR destination pixels.
+ */
+void overlayBGRARow(uchar* dst, const uchar* overlay, int width)
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint16x8 maxAlpha{ cv::v_setall_u16(255) };
+
+	for (; x <= width - 16; x += 16)
+	{
+		cv::v_uint8x16 ob, og, orr, oa;
+		cv::v_load_deinterleave(overlay + 4 * x, ob, og, orr, oa);
+
+		// Fully transparent block: nothing to do
+		if (!cv::v_check_any(oa != cv::v_setzero_u8()))
+			continue;
+
+		cv::v_uint8x16 db, dg, dr;
+		cv::v_load_deinterleave(dst + 3 * x, db, dg, dr);
+
+		cv::v_uint8x16* channels[]{ &db, &dg, &dr };
+		const cv::v_uint8x16* overlayChannels[]{ &ob, &og, &orr };
+
+		cv::v_uint16x8 aLow, aHigh;
+		cv::v_expand(oa, aLow, aHigh);
+		cv::v_uint16x8 invLow{ cv::v_sub_wrap(maxAlpha, aLow) };
+		cv::v_uint16x8 invHigh{ cv::v_sub_wrap(maxAlpha, aHigh) };
+
+		for (int c{ 0 }; c < 3; ++c)
+		{
+			cv::v_uint16x8 dLow, dHigh, oLow, oHigh;
+			cv::v_expand(*channels[c], dLow, dHigh);
+			cv::v_expand(*overlayChannels[c], oLow, oHigh);
+
+			cv::v_uint16x8 low{ div255(cv::v_add_wrap(cv::v_mul_wrap(dLow, invLow), cv::v_mul_wrap(oLow, aLow))) };
+			cv::v_uint16x8 high{ div255(cv::v_add_wrap(cv::v_mul_wrap(dHigh, invHigh), cv::v_mul_wrap(oHigh, aHigh))) };
+			*channels[c] = cv::v_pack(low, high);
+		}
+
+		cv::v_store_interleave(dst + 3 * x, db, dg, dr);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		const uchar* o{ overlay + 4 * x };
+		uchar* d{ dst + 3 * x };
+		int alpha{ o[3] };
+
+		for (int c{ 0 }; c < 3; ++c)
+			d[c] = static_cast<uchar>(div255(d[c] * (255 - alpha) + o[c] * alpha));
+	}
+}
+
+/**
+ * \brief Blend BGRA overlay into the region of BGR image in a single pass.
+ * \param dst Destination image (CV_8UC3), modified in place.
+ * \param roi Position of the overlay in dst (size equal to the size of the overlay), it can be partly outside of dst.
+ * \param overlay Overlay image (CV_8UC4, BGRA).
+ */
+void overlayBGRA(cv::Mat& dst, const cv::Rect& roi, const cv::Mat& overlay)
+{
+	CV_Assert(dst.type() == CV_8UC3);
+	CV_Assert(overlay.type() == CV_8UC4);
+	CV_Assert(roi.size() == overlay.size());
+
+	cv::Rect visible{ roi & cv::Rect(0, 0, dst.cols, dst.rows) };
+	if (visible.empty())
+		return;
+
+	int offsetX{ visible.x - roi.x };
+	int offsetY{ visible.y - roi.y };
+
+	for (int y{ 0 }; y < visible.height; ++y)
+		overlayBGRARow(dst.ptr<uchar>(visible.y + y) + 3 * visible.x, overlay.ptr<uchar>(offsetY + y) + 4 * offsetX, visible.width);
+}
+
+
+/**
+ * Cache of an overlay asset at many sizes.
+ * Resizing the full resolution asset for every face in every frame is wasteful. The cache keeps a mip pyramid of the
+ * asset (full size, 1/2, 1/4, ...) built once, and answers each request by resizing from the smallest level which is
+ * still larger than the requested size. The most recently used exact sizes are kept in a small LRU list, faces in a
+ * video change their size very little, so most requests are served without any resize at all.
+ * The cache is thread safe, returned cv::Mat headers stay valid even after the entry is evicted.
+ */
+class OverlayCache
+{
+public:
+	explicit OverlayCache(const cv::Mat& asset, size_t capacity = 16)
+		: capacity_(capacity)
+	{
+		CV_Assert(!asset.empty());
+
+		// Level 0 is the original, every next level has half of the size
+		levels_.push_back(asset);
+		while (levels_.back().cols >= 16 and levels_.back().rows >= 16)
+		{
+			cv::Mat half;
+			cv::resize(levels_.back(), half, cv::Size(levels_.back().cols / 2, levels_.back().rows / 2), 0, 0, cv::INTER_AREA);
+			levels_.push_back(half);
+		}
+	}
+
+	/**
+	 * \brief Get the asset resized to the exact size.
+	 * \param size Requested size.
+	 * \return Resized asset (shared, do not modify).
+	 */
+	cv::Mat get(cv::Size size)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			if (cv::Mat* cached{ find(size) })
+			{
+				++hits_;
+				return *cached;
+			}
+			++misses_;
+		}
+
+		// Resize without the lock, other threads keep hitting the cache meanwhile (levels_ never change)
+		// Smallest level which is not smaller than the requested size, area interpolation from there is cheap
+		size_t level{ 0 };
+		while (level + 1 < levels_.size() and levels_[level + 1].cols >= size.width and levels_[level + 1].rows >= size.height)
+			++level;
+
+		cv::Mat resized;
+		int interpolation{ levels_[level].cols >= size.width ? cv::INTER_AREA : cv::INTER_LINEAR };
+		cv::resize(levels_[level], resized, size, 0, 0, interpolation);
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+
+		// Another thread may have inserted the same size while we were resizing
+		if (cv::Mat* cached{ find(size) })
+			return *cached;
+
+		entries_.emplace_front(size, resized);
+		if (entries_.size() > capacity_)
+			entries_.pop_back();
+
+		return resized;
+	}
+
+	int hits() const { return hits_; }
+	int misses() const { return misses_; }
+
+private:
+	/**
+	 * \brief Find an entry and move it to the front (most recently used), the caller holds mutex_.
+	 */
+	cv::Mat* find(cv::Size size)
+	{
+		for (auto it{ entries_.begin() }; it != entries_.end(); ++it)
+		{
+			if (it->first == size)
+			{
+				entries_.splice(entries_.begin(), entries_, it);
+				return &entries_.front().second;
+			}
+		}
+		return nullptr;
+	}
+
+	std::vector<cv::Mat> levels_;
+	std::list<std::pair<cv::Size, cv::Mat>> entries_; // LRU, the most recently used at the front
+	size_t capacity_;
+	std::mutex mutex_;
+	int hits_{ 0 };
+	int misses_{ 0 };
+};
+
+/**
+ * \brief Position of the sunglasses for a face: as wide as the face, at about 30% of the face height.
+ * \param face Face rectangle.
+ * \param assetSize Size of the sunglasses image (for the aspect ratio).
+ * \return Rectangle where the sunglasses should be blended.
+ */
+cv::Rect eyeRegionForFace(const cv::Rect& face, cv::Size assetSize)
+{
+	int width{ face.width };
+	int height{ std::max(1, width * assetSize.height / assetSize.width) };
+	return cv::Rect(face.x, face.y + static_cast<int>(0.3 * face.height) - height / 4, width, height);
+}
+
+/**
+ * \brief Blend sunglasses on every face. Faces are processed in parallel, a face whose sunglasses overlap sunglasses
+ * of an earlier face is blended afterwards, so no two threads ever write the same pixels.
+ * \param frame Image (BGR), modified in place.
+ * \param faces Detected faces.
+ * \param cache Cache of the sunglasses image.
+ * \param assetSize Size of the original sunglasses image.
+ */
+void addSunglassesToFaces(cv::Mat& frame, const std::vector<cv::Rect>& faces, OverlayCache& cache, cv::Size assetSize)
+{
+	std::vector<cv::Rect> independent;
+	std::vector<cv::Rect> overlapping;
+
+	for (const auto& face : faces)
+	{
+		cv::Rect region{ eyeRegionForFace(face, assetSize) };
+		bool overlaps{ std::any_of(independent.begin(), independent.end(),
+			[&](const cv::Rect& r) { return (r & region).area() > 0; }) };
+
+		(overlaps ? overlapping : independent).push_back(region);
+	}
+
+	cv::parallel_for_(cv::Range(0, static_cast<int>(independent.size())), [&](const cv::Range& range)
+	{
+		for (int i{ range.start }; i < range.end; ++i)
+			overlayBGRA(frame, independent[i], cache.get(independent[i].size()));
+	});
+
+	for (const auto& region : overlapping)
+		overlayBGRA(frame, region, cache.get(region.size()));
+}
+
+
+// Settings of FaceTracker
+struct FaceTrackerSettings
+{
+	int detectEvery{ 15 };          // run full detection at least every N frames
+	double minConfidence{ 0.6 };    // re-detect when template matching score of any face drops below this value
+	double searchMargin{ 0.3 };     // search window = last face enlarged by this fraction of its size on every side
+	int workingWidth{ 480 };        // width of the downscaled gray frame used by detection and tracking
+};
+
+/**
+ * Face tracker which runs cv::CascadeClassifier only from time to time.
+ * Detection and tracking work on a downscaled gray copy of the frame, faces are returned in frame coordinates.
+ * Every face has its own template, when any of them is lost the full detection runs again.
+ */
+class FaceTracker
+{
+public:
+	FaceTracker(cv::CascadeClassifier& cascade, const FaceTrackerSettings& settings = FaceTrackerSettings())
+		: cascade_(cascade), settings_(settings)
+	{}
+
+	/**
+	 * \brief Find faces in the next frame.
+	 * \param frame Frame (BGR).
+	 * \param faces Output positions of the faces in the frame.
+	 * \return True if at least one face was found.
+	 */
+	bool update(const cv::Mat& frame, std::vector<cv::Rect>& faces)
+	{
+		scale_ = std::min(1.0, static_cast<double>(settings_.workingWidth) / frame.cols);
+		cv::resize(frame, small_, cv::Size(), scale_, scale_, cv::INTER_AREA);
+		cv::cvtColor(small_, gray_, cv::COLOR_BGR2GRAY);
+
+		bool found{ false };
+		bool needDetection{ tracked_.empty() or framesSinceDetection_ >= settings_.detectEvery };
+
+		if (!needDetection)
+		{
+			found = track();
+
+			// Tracking is lost, fall back to detection in the same frame
+			if (!found)
+				needDetection = true;
+			else
+				++skippedDetections_;
+		}
+
+		if (needDetection)
+			found = detect();
+
+		// Back to the frame coordinates
+		faces.clear();
+		for (const auto& t : tracked_)
+			faces.emplace_back(cvRound(t.face.x / scale_), cvRound(t.face.y / scale_), cvRound(t.face.width / scale_), cvRound(t.face.height / scale_));
+
+		return found;
+	}
+
+	int detections() const { return detections_; }
+	int skippedDetections() const { return skippedDetections_; }
+
+private:
+	struct TrackedFace
+	{
+		cv::Rect face;      // face in the downscaled frame
+		cv::Mat templ;      // how the face looked like at the last detection
+	};
+
+	// Full Haar cascade detection
+	bool detect()
+	{
+		++detections_;
+		framesSinceDetection_ = 0;
+
+		std::vector<cv::Rect> faces;
+		cascade_.detectMultiScale(gray_, faces, 1.2, 5, 0, cv::Size(24, 24));
+
+		// Remember how the faces look like, they are our templates until the next detection
+		tracked_.clear();
+		for (const auto& face : faces)
+			tracked_.push_back({ face, gray_(face).clone() });
+
+		return !tracked_.empty();
+	}
+
+	// Template matching in a small window around the last position of every face
+	bool track()
+	{
+		++framesSinceDetection_;
+
+		for (auto& t : tracked_)
+		{
+			int marginX{ cvRound(t.face.width * settings_.searchMargin) };
+			int marginY{ cvRound(t.face.height * settings_.searchMargin) };
+			cv::Rect window{ cv::Rect(t.face.x - marginX, t.face.y - marginY, t.face.width + 2 * marginX, t.face.height + 2 * marginY)
+				& cv::Rect(0, 0, gray_.cols, gray_.rows) };
+
+			if (window.width < t.templ.cols or window.height < t.templ.rows)
+				return false;
+
+			cv::matchTemplate(gray_(window), t.templ, scores_, cv::TM_CCOEFF_NORMED);
+
+			double maxScore;
+			cv::Point maxLoc;
+			cv::minMaxLoc(scores_, nullptr, &maxScore, nullptr, &maxLoc);
+
+			if (maxScore < settings_.minConfidence)
+				return false;
+
+			t.face.x = window.x + maxLoc.x;
+			t.face.y = window.y + maxLoc.y;
+		}
+
+		return true;
+	}
+
+	cv::CascadeClassifier& cascade_;
+	FaceTrackerSettings settings_;
+
+	// Buffers reused between frames
+	cv::Mat small_;
+	cv::Mat gray_;
+	cv::Mat scores_;
+
+	std::vector<TrackedFace> tracked_;
+	double scale_{ 1.0 };
+	int framesSinceDetection_{ 0 };
+	int detections_{ 0 };
+	int skippedDetections_{ 0 };
+};
+
+/**
+ * \brief Sunglasses filter on video with detection skipping.
+ * \param source Path to a video file or a camera index.
+ * \param glassPNG Sunglasses image with alpha channel (BGRA).
+ * \param cascadePath Path to Haar cascade for frontal faces.
+ * \return Exit code.
+ */
+int runVideoMode(const std::string& source, const cv::Mat& glassPNG, const std::string& cascadePath)
+{
+	cv::VideoCapture cap;
+	if (!source.empty() and std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); }))
+		cap.open(std::stoi(source));
+	else
+		cap.open(source);
+
+	if (!cap.isOpened())
+	{
+		std::cout << "Can't open video source: " << source << std::endl;
+		return -1;
+	}
+
+	cv::CascadeClassifier faceCascade;
+	if (!faceCascade.load(cascadePath))
+	{
+		std::cout << "Can't load cascade: " << cascadePath << std::endl;
+		return -1;
+	}
+
+	FaceTracker tracker{ faceCascade };
+	OverlayCache glassCache{ glassPNG };
+
+	cv::Mat frame;
+	std::vector<cv::Rect> faces;
+	std::vector<double> latencies;
+
+	while (cap.read(frame))
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		if (tracker.update(frame, faces))
+			addSunglassesToFaces(frame, faces, glassCache, glassPNG.size());
+
+		auto stop = std::chrono::steady_clock::now();
+		double latency{ std::chrono::duration<double, std::milli>(stop - start).count() };
+		latencies.push_back(latency);
+
+		cv::putText(frame, cv::format("%.1f ms, faces: %d, skipped detections: %d", latency, static_cast<int>(faces.size()), tracker.skippedDetections()),
+			cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.8, cv::Scalar(0, 255, 0), 2, cv::LINE_AA);
+
+		cv::imshow("Sunglasses filter", frame);
+		if ((cv::waitKey(1) & 0xFF) == 27) // 'ESC' to stop
+			break;
+	}
+
+	cap.release();
+	cv::destroyAllWindows();
+
+	if (latencies.empty())
+		return 0;
+
+	// Summary: how much work the tracker and the overlay cache saved and how long a frame took
+	std::sort(latencies.begin(), latencies.end());
+	double total{ 0 };
+	for (double l : latencies)
+		total += l;
+
+	std::cout << "Frames: " << latencies.size() << std::endl;
+	std::cout << "Detections: " << tracker.detections() << ", skipped detections: " << tracker.skippedDetections() << std::endl;
+	std::cout << "Overlay cache hits: " << glassCache.hits() << ", misses: " << glassCache.misses() << std::endl;
+	std::cout << "Latency [ms] mean: " << total / latencies.size() << ", median: " << latencies[latencies.size() / 2]
+		<< ", max: " << latencies.back() << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char** argv)
 {
 	// Load face image from disk
 	cv::Mat faceImage{ cv::imread("../data/images/musk.jpg") };
@@ -23,6 +490,10 @@ int main()
 	// Load sunglasses image with alpha channel
 	cv::Mat glassPNG{ cv::imread("../data/images/sunglass.png", cv::IMREAD_UNCHANGED) };
 
+	// Video mode when a video file or a camera index is given
+	if (argc > 1)
+		return runVideoMode(argv[1], glassPNG, "haarcascade_frontalface_default.xml");
+
 	// Resize the sunglasses image to fit over the eye region
 	cv::resize(glassPNG, glassPNG, cv::Size(300, 100));
 
@@ -111,6 +582,17 @@ int main()
 	cv::waitKey(0);
 	cv::destroyWindow("Face with glasses");
 
+	// Sunglasses on every detected face, from the cached full resolution image
+	cv::Mat glassOriginal{ cv::imread("../data/images/sunglass.png", cv::IMREAD_UNCHANGED) };
+	OverlayCache glassCache{ glassOriginal };
+
+	cv::Mat faceWithGlassesAll = faceImage.clone();
+	addSunglassesToFaces(faceWithGlassesAll, faces, glassCache, glassOriginal.size());
+
+	cv::imshow("All faces with glasses", faceWithGlassesAll);
+	cv::waitKey(0);
+	cv::destroyWindow("All faces with glasses");
+
 
 
 	return 0;
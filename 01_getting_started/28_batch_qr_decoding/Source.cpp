@@ -0,0 +1,444 @@
+/*
+ * Batch QR code decoding
+ * The QR exercise (27_exercise_build_a_qr) runs cv::QRCodeDetector::detectAndDecode() on a single full resolution
+ * image. That is fine for one ID card, but not for a directory with thousands of scans: most of the time is spent
+ * searching for the finder patterns in millions of pixels which contain no code at all.
+ *
+ * This program decodes all images in a directory in three stages:
+ *	1. Load - cv::imread() of the scan.
+ *	2. Localize - the image is downscaled so its width is at most --work-width pixels and cv::QRCodeDetector::detect()
+ *	   finds the four corners of the code there. Finder patterns are large, so they survive the downscale.
+ *	3. Decode - the corners are scaled back to the full resolution, a small region of interest (ROI) around them is
+ *	   cropped from the original image and only this ROI is decoded with cv::QRCodeDetector::decode(). The code is
+ *	   read from full resolution pixels, so small modules are not lost.
+ * If the code is not found in the downscaled image or the ROI can not be decoded, the whole image is decoded as in the
+ * exercise, so the batch never reads less than the simple version.
+ *
+ * Images are spread over a pool of worker threads. cv::QRCodeDetector is not meant to be shared between threads, so
+ * every worker owns its own detector. Workers take the next image index from an atomic counter, which balances the
+ * load when some images are slower than others.
+ *
+ * The result is a manifest (CSV or JSON, chosen by the extension of --out) with the decoded text, the corners and the
+ * time of every stage for every image. At the end the throughput (images per second) and the average time of each
+ * stage are printed.
+ *
+ * Usage:
+ *	Source <directory> [--threads N] [--work-width 640] [--out manifest.csv]
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/objdetect.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Settings from the command line
+struct BatchSettings
+{
+	std::string directory;
+	int threads{ 0 }; // 0 = number of logical CPUs
+	int workWidth{ 640 }; // width of the image used for localization
+	double roiMargin{ 0.15 }; // margin added around the code, relative to its size
+	std::string outputPath{ "qr_manifest.csv" };
+};
+
+// Which path decoded the image
+enum class DecodePath
+{
+	None,
+	Roi,
+	FullImage,
+};
+
+// Result of one image
+struct QRResult
+{
+	std::string file;
+	bool loaded{ false };
+	DecodePath path{ DecodePath::None };
+	std::string text;
+	std::vector<cv::Point2f> corners; // in full resolution coordinates
+	double loadMs{ 0 };
+	double localizeMs{ 0 };
+	double decodeMs{ 0 };
+};
+
+/**
+ * \brief Milliseconds elapsed since start.
+ * \param start Time point.
+ * \return Elapsed time in milliseconds.
+ */
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * \brief Find all images in a directory.
+ * \param directory Path to the directory.
+ * \return Sorted list of paths.
+ */
+std::vector<std::string> listImages(const std::string& directory)
+{
+	std::vector<cv::String> all;
+	cv::glob(directory + "/*", all, false);
+
+	const std::vector<std::string> extensions{ ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff" };
+
+	std::vector<std::string> images;
+	for (const auto& path : all)
+	{
+		std::string lower{ path };
+		std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+		for (const auto& extension : extensions)
+		{
+			if (lower.size() >= extension.size() and lower.compare(lower.size() - extension.size(), extension.size(), extension) == 0)
+			{
+				images.push_back(path);
+				break;
+			}
+		}
+	}
+
+	std::sort(images.begin(), images.end());
+	return images;
+}
+
+/**
+ * \brief Load, localize and decode one image.
+ * \param path Path of the image.
+ * \param detector Detector owned by the calling thread.
+ * \param settings Batch settings.
+ * \return Result with timing of every stage.
+ */
+QRResult processImage(const std::string& path, cv::QRCodeDetector& detector, const BatchSettings& settings)
+{
+	QRResult result;
+	result.file = path;
+
+	// Stage 1: Load
+	auto start{ std::chrono::steady_clock::now() };
+	cv::Mat img{ cv::imread(path, cv::IMREAD_GRAYSCALE) };
+	result.loadMs = elapsedMs(start);
+
+	if (img.empty())
+		return result;
+	result.loaded = true;
+
+	// Stage 2: Localize on a downscaled copy
+	start = std::chrono::steady_clock::now();
+
+	double scale{ std::min(1.0, static_cast<double>(settings.workWidth) / img.cols) };
+	cv::Mat small;
+	if (scale < 1)
+		cv::resize(img, small, cv::Size(), scale, scale, cv::INTER_AREA);
+	else
+		small = img;
+
+	std::vector<cv::Point2f> smallCorners;
+	bool found{ detector.detect(small, smallCorners) and smallCorners.size() == 4 };
+	result.localizeMs = elapsedMs(start);
+
+	// Stage 3: Decode the full resolution ROI around the candidate
+	start = std::chrono::steady_clock::now();
+
+	if (found)
+	{
+		std::vector<cv::Point2f> corners;
+		for (const auto& p : smallCorners)
+			corners.emplace_back(p.x / static_cast<float>(scale), p.y / static_cast<float>(scale));
+
+		cv::Rect box{ cv::boundingRect(corners) };
+		int margin{ cvRound(std::max(box.width, box.height) * settings.roiMargin) };
+		box = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & cv::Rect(0, 0, img.cols, img.rows);
+
+		if (!box.empty())
+		{
+			std::vector<cv::Point2f> roiCorners;
+			for (const auto& p : corners)
+				roiCorners.emplace_back(p.x - box.x, p.y - box.y);
+
+			std::string text{ detector.decode(img(box), roiCorners) };
+			if (!text.empty())
+			{
+				result.path = DecodePath::Roi;
+				result.text = text;
+				result.corners = corners;
+			}
+		}
+	}
+
+	// Fallback: the full image, exactly like the single image exercise
+	if (result.path == DecodePath::None)
+	{
+		std::vector<cv::Point2f> corners;
+		std::string text{ detector.detectAndDecode(img, corners) };
+		if (!text.empty())
+		{
+			result.path = DecodePath::FullImage;
+			result.text = text;
+			result.corners = corners;
+		}
+	}
+
+	result.decodeMs = elapsedMs(start);
+
+	return result;
+}
+
+/**
+ * \brief Decode all images with a pool of worker threads, one detector per worker.
+ * \param files Paths of the images.
+ * \param settings Batch settings.
+ * \return Results in the same order as files.
+ */
+std::vector<QRResult> processBatch(const std::vector<std::string>& files, const BatchSettings& settings)
+{
+	std::vector<QRResult> results(files.size());
+	std::atomic<size_t> next{ 0 };
+
+	int threadCount{ settings.threads > 0 ? settings.threads : cv::getNumberOfCPUs() };
+	threadCount = std::max(1, std::min<int>(threadCount, static_cast<int>(files.size())));
+
+	auto worker = [&]()
+	{
+		cv::QRCodeDetector detector;
+
+		for (size_t i{ next++ }; i < files.size(); i = next++)
+			results[i] = processImage(files[i], detector, settings);
+	};
+
+	std::vector<std::thread> pool;
+	for (int t{ 0 }; t < threadCount; ++t)
+		pool.emplace_back(worker);
+
+	for (auto& thread : pool)
+		thread.join();
+
+	return results;
+}
+
+/**
+ * \brief Name of the decode path for the manifest.
+ */
+const char* decodePathName(DecodePath path)
+{
+	switch (path)
+	{
+	case DecodePath::Roi: return "roi";
+	case DecodePath::FullImage: return "full";
+	default: return "none";
+	}
+}
+
+/**
+ * \brief Escape string to be a valid JSON string literal content.
+ * \param s Input string.
+ * \return Escaped string.
+ */
+std::string jsonEscape(const std::string& s)
+{
+	std::string out;
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '"':  out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:   out += c; break;
+		}
+	}
+	return out;
+}
+
+/**
+ * \brief Quote a CSV field, double quotes inside are doubled.
+ * \param s Input string.
+ * \return Quoted field.
+ */
+std::string csvQuote(const std::string& s)
+{
+	std::string out{ "\"" };
+	for (char c : s)
+	{
+		if (c == '"')
+			out += '"';
+		out += c;
+	}
+	return out + "\"";
+}
+
+/**
+ * \brief Corners as "x0 y0 x1 y1 x2 y2 x3 y3".
+ */
+std::string cornersToString(const std::vector<cv::Point2f>& corners)
+{
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	for (size_t i{ 0 }; i < corners.size(); ++i)
+		out << (i ? " " : "") << corners[i].x << " " << corners[i].y;
+	return out.str();
+}
+
+/**
+ * \brief Write the manifest. JSON if the path ends with .json, CSV otherwise.
+ * \param path Path of the output file.
+ * \param results Results of all images.
+ * \return True if the file was written.
+ */
+bool writeManifest(const std::string& path, const std::vector<QRResult>& results)
+{
+	std::ofstream out{ path };
+	if (!out)
+		return false;
+
+	const bool json{ path.size() >= 5 and path.compare(path.size() - 5, 5, ".json") == 0 };
+
+	out << std::fixed << std::setprecision(3);
+
+	if (json)
+	{
+		out << "[\n";
+		for (size_t i{ 0 }; i < results.size(); ++i)
+		{
+			const auto& r = results[i];
+			out << "  { \"file\": \"" << jsonEscape(r.file) << "\""
+				<< ", \"loaded\": " << std::boolalpha << r.loaded
+				<< ", \"decoded\": " << (r.path != DecodePath::None)
+				<< ", \"path\": \"" << decodePathName(r.path) << "\""
+				<< ", \"text\": \"" << jsonEscape(r.text) << "\""
+				<< ", \"corners\": [";
+			for (size_t k{ 0 }; k < r.corners.size(); ++k)
+				out << (k ? ", " : "") << "[" << r.corners[k].x << ", " << r.corners[k].y << "]";
+			out << "]"
+				<< ", \"load_ms\": " << r.loadMs
+				<< ", \"localize_ms\": " << r.localizeMs
+				<< ", \"decode_ms\": " << r.decodeMs
+				<< " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "]\n";
+	}
+	else
+	{
+		out << "file,loaded,decoded,path,text,corners,load_ms,localize_ms,decode_ms\n";
+		for (const auto& r : results)
+		{
+			out << csvQuote(r.file) << ","
+				<< (r.loaded ? 1 : 0) << ","
+				<< (r.path != DecodePath::None ? 1 : 0) << ","
+				<< decodePathName(r.path) << ","
+				<< csvQuote(r.text) << ","
+				<< csvQuote(cornersToString(r.corners)) << ","
+				<< r.loadMs << "," << r.localizeMs << "," << r.decodeMs << "\n";
+		}
+	}
+
+	return static_cast<bool>(out);
+}
+
+/**
+ * \brief Parse command line arguments.
+ * \param argc Number of arguments.
+ * \param argv Arguments.
+ * \param settings Output settings.
+ * \return False if arguments are wrong (usage should be printed).
+ */
+bool parseArguments(int argc, char** argv, BatchSettings& settings)
+{
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+
+		if (arg.rfind("--", 0) != 0)
+		{
+			settings.directory = arg;
+			continue;
+		}
+
+		// Every option expects a value
+		if (i + 1 >= argc)
+			return false;
+		std::string value{ argv[++i] };
+
+		if (arg == "--threads")
+			settings.threads = std::max(0, std::stoi(value));
+		else if (arg == "--work-width")
+			settings.workWidth = std::max(64, std::stoi(value));
+		else if (arg == "--out")
+			settings.outputPath = value;
+		else
+			return false;
+	}
+
+	return !settings.directory.empty();
+}
+
+
+int main(int argc, char** argv)
+{
+	BatchSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		std::cout << "Usage: " << argv[0] << " <directory> [--threads N] [--work-width 640] [--out manifest.csv|manifest.json]" << std::endl;
+		return -1;
+	}
+
+	std::vector<std::string> files{ listImages(settings.directory) };
+	if (files.empty())
+	{
+		std::cout << "No images found in " << settings.directory << std::endl;
+		return -1;
+	}
+
+	// Parallelism comes from the worker threads, OpenCV functions inside them should not start their own threads
+	cv::setNumThreads(1);
+
+	auto start{ std::chrono::steady_clock::now() };
+	std::vector<QRResult> results{ processBatch(files, settings) };
+	double totalSeconds{ elapsedMs(start) / 1000.0 };
+
+	// Summary
+	int loaded{ 0 }, roi{ 0 }, full{ 0 };
+	double loadMs{ 0 }, localizeMs{ 0 }, decodeMs{ 0 };
+	for (const auto& r : results)
+	{
+		loaded += r.loaded;
+		roi += r.path == DecodePath::Roi;
+		full += r.path == DecodePath::FullImage;
+		loadMs += r.loadMs;
+		localizeMs += r.localizeMs;
+		decodeMs += r.decodeMs;
+	}
+
+	const double n{ static_cast<double>(results.size()) };
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Images: " << results.size() << " (loaded " << loaded << ")" << std::endl;
+	std::cout << "Decoded: " << roi + full << " (ROI " << roi << ", full image fallback " << full << ")" << std::endl;
+	std::cout << "Total time: " << totalSeconds << " s, " << n / totalSeconds << " images/s" << std::endl;
+	std::cout << "Average per image - load: " << loadMs / n << " ms, localize: " << localizeMs / n
+		<< " ms, decode: " << decodeMs / n << " ms" << std::endl;
+
+	if (!writeManifest(settings.outputPath, results))
+	{
+		std::cout << "Could not write " << settings.outputPath << std::endl;
+		return -1;
+	}
+	std::cout << "Manifest written to " << settings.outputPath << std::endl;
+
+	return 0;
+}
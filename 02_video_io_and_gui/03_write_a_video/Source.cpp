@@ -42,8 +42,13 @@ int main()
 	cap >> frame;
 	bool isColor = (frame.type() == CV_8UC3);
 
+	// Write with the frame rate of the source, so the output plays at the original speed (cameras may report 0)
+	double fps = cap.get(cv::CAP_PROP_FPS);
+	if (!(fps > 0))
+		fps = 30;
+
 	// Define the codec and create VideoWriter object
-	cv::VideoWriter out{ "outputChaplin.mp4", cv::VideoWriter::fourcc('M', 'P', 'G', '4'), 10, cv::Size(width, height), isColor};
+	cv::VideoWriter out{ "outputChaplin.mp4", cv::VideoWriter::fourcc('M', 'P', 'G', '4'), fps, cv::Size(width, height), isColor};
 
 	// Read until video is completed
 	while(cap.isOpened())
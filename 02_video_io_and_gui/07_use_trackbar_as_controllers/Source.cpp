@@ -22,12 +22,137 @@
  * In this case we will create two trackbars:
  *	1. For getting the scaling type.
  *	2. For getting the percentage of scaling to be done.
+ *
+ * Large images:
+ * Dragging the slider produces many events per second and resizing a big image (tens of megapixels) on each of them
+ * makes the window unresponsive. So the callback only shows a preview: a Gaussian pyramid of the image is built once
+ * (every level is half the size of the previous one, see cv::pyrDown). The preview has a fixed budget of pixels (about
+ * a Full HD window): it has the size of the result, shrunk to fit into the budget if the result is larger, and it is
+ * resampled from the smallest level which is still at least as large as the preview. That is cheap for any scale,
+ * because the level is at most twice the size of the preview. The full quality resize of the original image runs on a
+ * worker thread after the slider has not moved for a while, and the main loop shows its result when it is ready.
  */
 
 #include <string>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Resizes the full image on a background thread once the requests stop changing.
+ * Each new request restarts the settle delay, so while the slider is dragged nothing is computed.
+ */
+class FullQualityResizer
+{
+public:
+	/**
+	 * \brief Start the worker thread.
+	 * \param image Full resolution image.
+	 * \param settleDelay How long the scale must stay the same before the full resize starts.
+	 */
+	FullQualityResizer(const cv::Mat& image, std::chrono::milliseconds settleDelay = std::chrono::milliseconds(200))
+		: image_(image), settleDelay_(settleDelay), worker_(&FullQualityResizer::run, this)
+	{}
+
+	~FullQualityResizer()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			stop_ = true;
+		}
+		condition_.notify_one();
+		worker_.join();
+	}
+
+	FullQualityResizer(const FullQualityResizer&) = delete;
+	FullQualityResizer& operator=(const FullQualityResizer&) = delete;
+
+	/**
+	 * \brief Ask for the image at a new scale. A result of an older request is dropped.
+	 * \param scale Scale factor.
+	 */
+	void request(double scale)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			scale_ = scale;
+			++generation_;
+			deadline_ = std::chrono::steady_clock::now() + settleDelay_;
+			result_.release();
+		}
+		condition_.notify_one();
+	}
+
+	/**
+	 * \brief Take the finished result of the latest request.
+	 * \param result Output image.
+	 * \return True if there was a new result.
+	 */
+	bool takeResult(cv::Mat& result)
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		if (result_.empty())
+			return false;
+
+		result = result_;
+		result_.release();
+		return true;
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		unsigned long long done{ 0 };
+
+		while (true)
+		{
+			condition_.wait(lock, [this, done] { return stop_ or generation_ != done; });
+			if (stop_)
+				break;
+
+			// Wait until the requests stop coming
+			condition_.wait_until(lock, deadline_, [this] { return stop_ or std::chrono::steady_clock::now() >= deadline_; });
+			if (stop_)
+				break;
+			if (std::chrono::steady_clock::now() < deadline_) // a newer request moved the deadline
+				continue;
+
+			unsigned long long generation{ generation_ };
+			double scale{ scale_ };
+			done = generation;
+
+			lock.unlock();
+			cv::Mat resized;
+			cv::resize(image_, resized, cv::Size(), scale, scale, cv::INTER_LINEAR);
+			lock.lock();
+
+			// Publish only if the slider did not move in the meantime
+			if (generation == generation_)
+				result_ = resized;
+		}
+	}
+
+	cv::Mat image_;
+	std::chrono::milliseconds settleDelay_;
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	double scale_{ 1 };
+	unsigned long long generation_{ 0 };
+	std::chrono::steady_clock::time_point deadline_;
+	cv::Mat result_;
+	bool stop_{ false };
+
+	std::thread worker_; // last, so it starts after the other members are initialized
+};
 
 // Structure helper to handle global variables.
 struct TrackBarsParams
@@ -39,6 +164,8 @@ struct TrackBarsParams
 	int maxType; // maximum value for the type trackbar
 	std::string windowName; // is the name of the window where the trackbars are displayed
 	cv::Mat im; // cv::Mast to store image 
+	std::vector<cv::Mat> pyramid; // im and its downscaled versions, used for previews
+	FullQualityResizer* resizer{ nullptr }; // computes the final image after the slider settles
 
 	// Constructor with default values.
 	TrackBarsParams(int mS=100, int sF=1, int sT=0, int mT=1, std::string wN="Resize Image")
@@ -48,6 +175,53 @@ struct TrackBarsParams
 
 void scaleImage(int, void* userdata);
 
+/**
+ * \brief Build a Gaussian pyramid, every level has half the size of the previous one.
+ * \param image Level 0.
+ * \param minSize Levels stop when the smaller side would drop below this size.
+ * \return Pyramid levels.
+ */
+std::vector<cv::Mat> buildPyramid(const cv::Mat& image, int minSize = 32)
+{
+	std::vector<cv::Mat> pyramid{ image };
+
+	while (std::min(pyramid.back().cols, pyramid.back().rows) / 2 >= minSize)
+	{
+		cv::Mat down;
+		cv::pyrDown(pyramid.back(), down);
+		pyramid.push_back(down);
+	}
+
+	return pyramid;
+}
+
+/**
+ * \brief Quick approximation of the resized image from the pyramid.
+ * \param pyramid Pyramid from buildPyramid().
+ * \param scale Scale factor relative to level 0.
+ * \param maxPixels Pixel budget of the preview.
+ * \return Preview image. Same size as the full quality result if that fits into maxPixels, otherwise smaller with the
+ * same aspect ratio.
+ */
+cv::Mat pyramidPreview(const std::vector<cv::Mat>& pyramid, double scale, double maxPixels = 1920.0 * 1080.0)
+{
+	// Results larger than the budget are previewed at a smaller scale
+	const double outputPixels{ pyramid[0].total() * scale * scale };
+	if (outputPixels > maxPixels)
+		scale *= std::sqrt(maxPixels / outputPixels);
+
+	const cv::Size size(std::max(1, cvRound(pyramid[0].cols * scale)), std::max(1, cvRound(pyramid[0].rows * scale)));
+
+	// Smallest level which is not smaller than the preview
+	cv::Mat preview;
+	size_t level{ 0 };
+	while (level + 1 < pyramid.size() and pyramid[level + 1].cols >= size.width and pyramid[level + 1].rows >= size.height)
+		++level;
+
+	cv::resize(pyramid[level], preview, size, 0, 0, cv::INTER_LINEAR);
+	return preview;
+}
+
 int main()
 {
 	TrackBarsParams tbp;
@@ -60,6 +234,11 @@ int main()
 	// load an image
 	tbp.im = cv::imread("../data/truth.png");
 
+	// Previews are resampled from the pyramid, the final image is resized from the original in the background
+	tbp.pyramid = buildPyramid(tbp.im);
+	FullQualityResizer resizer(tbp.im);
+	tbp.resizer = &resizer;
+
 	// Create a window to display results
 	cv::namedWindow(tbp.windowName, cv::WINDOW_AUTOSIZE);
 
@@ -77,6 +256,11 @@ int main()
 		c = cv::waitKey(20);
 		if (static_cast<char>(c) == 27) // Hit 'ESC' to break from the loop
 			break;
+
+		// Replace the preview when the full quality image is ready
+		cv::Mat finalImage;
+		if (resizer.takeResult(finalImage))
+			cv::imshow(tbp.windowName, finalImage);
 	}
 
 	cv::destroyAllWindows();
@@ -100,7 +284,11 @@ void scaleImage(int, void* userdata)
 
 	cv::Mat scaledImage;
 
-	cv::resize(tbp->im, scaledImage, cv::Size(), scaleFactorDouble, scaleFactorDouble, cv::INTER_LINEAR);
+	// Show a cheap preview now and let the worker compute the full quality image when the slider stops
+	scaledImage = pyramidPreview(tbp->pyramid, scaleFactorDouble);
 	cv::imshow(tbp->windowName, scaledImage);
 
+	if (tbp->resizer)
+		tbp->resizer->request(scaleFactorDouble);
+
 }
\ No newline at end of file
@@ -0,0 +1,388 @@
+/*
+ * Pipelined video reading
+ * 01_read_and_display_a_video_in_opencv (and most video loops of the course) do everything on one thread:
+ *	cap >> frame;          // decode
+ *	process(frame);        // processing
+ *	cv::imshow(...);       // display
+ * so the time per frame is the sum of the three steps, and while the frame is being decoded the processing code waits
+ * and the other cores are idle.
+ *
+ * A pipeline runs every step on its own thread, the steps then overlap and the time per frame is the time of the
+ * slowest step only:
+ *	decode thread  -> ring -> processing thread -> ring -> display (main thread, cv::imshow must stay there)
+ *
+ * The rings (FrameRing) are lock-free queues for one producer and one consumer with a fixed number of preallocated
+ * slots. A stage writes directly into a free slot (cap.read(slot) and the processing output reuse the memory of the
+ * slot, no frame is allocated after the first round) and publishes it with a single atomic store. When the ring is
+ * full the producer waits (the pipeline never drops frames), when it is empty the consumer waits.
+ *
+ * Every stage reports:
+ *	- frames - how many frames it handled,
+ *	- busy - time spent doing its work,
+ *	- stall - time spent waiting for an input frame or for a free output slot,
+ *	- occupancy - average number of frames in its input ring. A ring which is always full means that the next stage is
+ *	  the bottleneck, a ring which is always empty means that the previous stage is.
+ *
+ * The program plays the video once with the loop of the lesson and once with the pipeline (without the waitKey(25)
+ * pause, we want to see how fast it can go) and prints both frame rates and the stage statistics.
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct StageStats
+{
+	size_t frames{ 0 };
+	double busyMs{ 0 };
+	double stallMs{ 0 };
+	double occupancySum{ 0 };
+	size_t occupancySamples{ 0 };
+
+	double occupancy() const
+	{
+		return occupancySamples ? occupancySum / occupancySamples : 0;
+	}
+};
+
+/**
+ * Lock-free ring of preallocated frames for one producer and one consumer thread.
+ */
+class FrameRing
+{
+public:
+	struct Slot
+	{
+		cv::Mat frame;
+		int index{ 0 };
+	};
+
+	explicit FrameRing(size_t capacity)
+		: slots_(capacity)
+	{}
+
+	/**
+	 * \brief Free slot for the producer, nullptr if the ring is full. The slot is not visible until publish().
+	 */
+	Slot* writeSlot()
+	{
+		const size_t head{ head_.load(std::memory_order_relaxed) };
+		if (head - tail_.load(std::memory_order_acquire) == slots_.size())
+			return nullptr;
+
+		return &slots_[head % slots_.size()];
+	}
+
+	void publish()
+	{
+		head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	 * \brief Oldest published slot for the consumer, nullptr if the ring is empty. The slot stays valid until consume().
+	 */
+	Slot* readSlot()
+	{
+		const size_t tail{ tail_.load(std::memory_order_relaxed) };
+		if (head_.load(std::memory_order_acquire) == tail)
+			return nullptr;
+
+		return &slots_[tail % slots_.size()];
+	}
+
+	void consume()
+	{
+		tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	 * \brief The producer will not publish anything more.
+	 */
+	void close()
+	{
+		closed_.store(true, std::memory_order_release);
+	}
+
+	bool closed() const
+	{
+		return closed_.load(std::memory_order_acquire);
+	}
+
+	size_t size() const
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector<Slot> slots_;
+
+	// Separate cache lines, the producer writes head_ and the consumer tail_
+	alignas(64) std::atomic<size_t> head_{ 0 };
+	alignas(64) std::atomic<size_t> tail_{ 0 };
+	std::atomic<bool> closed_{ false };
+};
+
+/**
+ * Decodes on one thread, processes on another, the caller displays the results.
+ */
+class VideoPipeline
+{
+public:
+	// Processing of one frame, output is a preallocated slot of the output ring
+	using Processor = std::function<void(const cv::Mat& input, cv::Mat& output)>;
+
+	/**
+	 * \brief Start the decoding and processing threads.
+	 * \param cap Opened video, used only by the decoding thread until the pipeline is stopped.
+	 * \param processor Processing of a frame.
+	 * \param capacity Number of frames in each ring.
+	 */
+	VideoPipeline(cv::VideoCapture& cap, Processor processor, size_t capacity = 4)
+		: cap_(cap), processor_(std::move(processor)), decoded_(capacity), processed_(capacity),
+		decoder_(&VideoPipeline::decode, this), worker_(&VideoPipeline::process, this)
+	{}
+
+	~VideoPipeline()
+	{
+		stop();
+	}
+
+	VideoPipeline(const VideoPipeline&) = delete;
+	VideoPipeline& operator=(const VideoPipeline&) = delete;
+
+	/**
+	 * \brief Wait for the next processed frame.
+	 * \return The frame, valid until pop(), or nullptr at the end of the video.
+	 */
+	const cv::Mat* front()
+	{
+		auto start{ std::chrono::steady_clock::now() };
+		displayStats_.occupancySum += processed_.size();
+		++displayStats_.occupancySamples;
+
+		FrameRing::Slot* slot{ waitFor([this] { return processed_.readSlot(); }, &processed_) };
+		displayStats_.stallMs += elapsedMs(start);
+
+		displayStart_ = std::chrono::steady_clock::now();
+		return slot ? &slot->frame : nullptr;
+	}
+
+	/**
+	 * \brief Return the frame from front() to the pipeline.
+	 */
+	void pop()
+	{
+		processed_.consume();
+		displayStats_.busyMs += elapsedMs(displayStart_);
+		++displayStats_.frames;
+	}
+
+	/**
+	 * \brief Stop both threads (eg. when the user closes the player before the end of the video).
+	 */
+	void stop()
+	{
+		stop_ = true;
+		if (decoder_.joinable())
+			decoder_.join();
+		if (worker_.joinable())
+			worker_.join();
+	}
+
+	// Valid after the end of the video or after stop()
+	const StageStats& decodeStats() const { return decodeStats_; }
+	const StageStats& processStats() const { return processStats_; }
+	const StageStats& displayStats() const { return displayStats_; }
+
+private:
+	static double elapsedMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/**
+	 * \brief Spin shortly, then sleep, until get() returns a slot, the input is closed and empty, or the pipeline stops.
+	 * \param get Returns a slot or nullptr.
+	 * \param input Ring which get() reads from, nullptr when waiting for a free output slot.
+	 */
+	template<typename Get>
+	FrameRing::Slot* waitFor(Get get, const FrameRing* input)
+	{
+		for (int attempt{ 0 }; !stop_; ++attempt)
+		{
+			if (FrameRing::Slot* slot{ get() })
+				return slot;
+
+			// closed() is checked before get() again, so a frame published just before close() is not lost
+			if (input and input->closed() and get() == nullptr)
+				return nullptr;
+
+			if (attempt < 64)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return nullptr;
+	}
+
+	void decode()
+	{
+		for (int index{ 0 }; !stop_; ++index)
+		{
+			auto start{ std::chrono::steady_clock::now() };
+			FrameRing::Slot* slot{ waitFor([this] { return decoded_.writeSlot(); }, nullptr) };
+			decodeStats_.stallMs += elapsedMs(start);
+			if (!slot)
+				break;
+
+			start = std::chrono::steady_clock::now();
+			bool ok{ cap_.read(slot->frame) };
+			decodeStats_.busyMs += elapsedMs(start);
+			if (!ok or slot->frame.empty())
+				break;
+
+			slot->index = index;
+			decoded_.publish();
+			++decodeStats_.frames;
+		}
+		decoded_.close();
+	}
+
+	void process()
+	{
+		while (!stop_)
+		{
+			auto start{ std::chrono::steady_clock::now() };
+			processStats_.occupancySum += decoded_.size();
+			++processStats_.occupancySamples;
+
+			FrameRing::Slot* input{ waitFor([this] { return decoded_.readSlot(); }, &decoded_) };
+			if (!input)
+			{
+				processStats_.stallMs += elapsedMs(start);
+				break;
+			}
+
+			FrameRing::Slot* output{ waitFor([this] { return processed_.writeSlot(); }, nullptr) };
+			processStats_.stallMs += elapsedMs(start);
+			if (!output)
+				break;
+
+			start = std::chrono::steady_clock::now();
+			processor_(input->frame, output->frame);
+			output->index = input->index;
+			processStats_.busyMs += elapsedMs(start);
+
+			decoded_.consume();
+			processed_.publish();
+			++processStats_.frames;
+		}
+		processed_.close();
+	}
+
+	cv::VideoCapture& cap_;
+	Processor processor_;
+	FrameRing decoded_;
+	FrameRing processed_;
+	std::atomic<bool> stop_{ false };
+
+	StageStats decodeStats_;
+	StageStats processStats_;
+	StageStats displayStats_;
+	std::chrono::steady_clock::time_point displayStart_;
+
+	// Started last, everything above must be initialized
+	std::thread decoder_;
+	std::thread worker_;
+};
+
+/**
+ * \brief Example processing: edges drawn over a blurred frame.
+ */
+void processFrame(const cv::Mat& input, cv::Mat& output)
+{
+	cv::Mat gray, edges;
+	cv::cvtColor(input, gray, cv::COLOR_BGR2GRAY);
+	cv::Canny(gray, edges, 50, 150);
+	cv::GaussianBlur(input, output, cv::Size(9, 9), 0);
+	output.setTo(cv::Scalar(0, 255, 0), edges);
+}
+
+void printStats(const std::string& name, const StageStats& stats)
+{
+	std::cout << std::left << std::setw(10) << name << std::right << std::setw(8) << stats.frames << std::setw(12)
+		<< stats.busyMs << std::setw(12) << stats.stallMs << std::setw(12) << stats.occupancy() << std::endl;
+}
+
+
+int main()
+{
+	const std::string videoPath{ "../data/chaplin.mp4" };
+
+	// Single thread, the loop of the lesson
+	cv::VideoCapture cap{ videoPath };
+	if (!cap.isOpened())
+	{
+		std::cout << "Error opening video stream or file!" << std::endl;
+		return 0;
+	}
+
+	int frames{ 0 };
+	auto start{ std::chrono::steady_clock::now() };
+	cv::Mat frame, output;
+	while (true)
+	{
+		cap >> frame;
+		if (frame.empty())
+			break;
+
+		processFrame(frame, output);
+		cv::imshow("Frame", output);
+		if (cv::waitKey(1) == 27)
+			break;
+		++frames;
+	}
+	double sequentialMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+	cap.release();
+
+	// Pipeline
+	cap.open(videoPath);
+	start = std::chrono::steady_clock::now();
+	VideoPipeline pipeline(cap, processFrame);
+	while (const cv::Mat* processed{ pipeline.front() })
+	{
+		cv::imshow("Frame", *processed);
+		int key{ cv::waitKey(1) };
+		pipeline.pop();
+
+		if (key == 27)
+			break;
+	}
+	pipeline.stop();
+	double pipelineMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	cap.release();
+	cv::destroyAllWindows();
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Single thread: " << frames << " frames, " << frames * 1000.0 / sequentialMs << " fps" << std::endl;
+	std::cout << "Pipeline: " << pipeline.displayStats().frames << " frames, " << pipeline.displayStats().frames * 1000.0 / pipelineMs
+		<< " fps" << std::endl << std::endl;
+
+	std::cout << std::left << std::setw(10) << "stage" << std::right << std::setw(8) << "frames" << std::setw(12) << "busy ms"
+		<< std::setw(12) << "stall ms" << std::setw(12) << "occupancy" << std::endl;
+	printStats("decode", pipeline.decodeStats());
+	printStats("process", pipeline.processStats());
+	printStats("display", pipeline.displayStats());
+
+	return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * Asynchronous video writing
+ * In 03_write_a_video every frame is encoded by out.write(frame) on the thread which reads and processes the video.
+ * Encoding MPEG-4 takes about as long as decoding, so a recording loop runs at half of the speed it could.
+ *
+ * AsyncVideoWriter has the same interface as cv::VideoWriter, but write() only copies the frame into a bounded queue
+ * and a dedicated encoder thread calls cv::VideoWriter::write(). The copies use a pool of preallocated frames, after
+ * the first frames nothing is allocated. When the encoder cannot keep up the queue fills up and write() either:
+ *	- Block      - waits for a free place, no frame is lost (recording of a file),
+ *	- DropOldest - removes the oldest queued frame, the producer never waits (live stream, where a missing frame is
+ *	               better than a growing delay).
+ *
+ * stats() reports the number of written and dropped frames, the queue depth (peak and average seen by write()) and
+ * the encode time per frame. A queue which is always full means that the encoder is the bottleneck.
+ *
+ * The video is written with the frame rate of the source (cap.get(cv::CAP_PROP_FPS)), so it plays at the original
+ * speed.
+ *
+ * The program copies the video with cv::VideoWriter and with AsyncVideoWriter and prints both frame rates.
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What write() does when the queue is full
+enum class QueuePolicy
+{
+	Block,
+	DropOldest,
+};
+
+struct VideoWriterStats
+{
+	size_t written{ 0 };
+	size_t dropped{ 0 };
+	size_t peakQueueDepth{ 0 };
+	double queueDepthSum{ 0 }; // sampled by every write()
+	size_t queueDepthSamples{ 0 };
+	double encodeMs{ 0 };
+	double maxEncodeMs{ 0 };
+	double blockedMs{ 0 };
+
+	double averageQueueDepth() const
+	{
+		return queueDepthSamples ? queueDepthSum / queueDepthSamples : 0;
+	}
+
+	double averageEncodeMs() const
+	{
+		return written ? encodeMs / written : 0;
+	}
+};
+
+/**
+ * cv::VideoWriter which encodes on a background thread.
+ */
+class AsyncVideoWriter
+{
+public:
+	/**
+	 * \brief Open the output, same arguments as cv::VideoWriter plus the queue settings.
+	 * \param capacity Maximum number of queued frames.
+	 * \param policy What write() does when the queue is full.
+	 */
+	AsyncVideoWriter(const std::string& filename, int fourcc, double fps, cv::Size frameSize, bool isColor = true,
+		size_t capacity = 8, QueuePolicy policy = QueuePolicy::Block)
+		: writer_(filename, fourcc, fps, frameSize, isColor), capacity_(std::max<size_t>(1, capacity)), policy_(policy)
+	{
+		if (writer_.isOpened())
+			encoder_ = std::thread(&AsyncVideoWriter::run, this);
+	}
+
+	~AsyncVideoWriter()
+	{
+		release();
+	}
+
+	AsyncVideoWriter(const AsyncVideoWriter&) = delete;
+	AsyncVideoWriter& operator=(const AsyncVideoWriter&) = delete;
+
+	bool isOpened() const
+	{
+		return writer_.isOpened();
+	}
+
+	/**
+	 * \brief Queue a copy of the frame, the frame can be reused right away.
+	 * \return False if the frame was dropped or the writer is closed.
+	 */
+	bool write(const cv::Mat& frame)
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		if (closed_ or !writer_.isOpened())
+			return false;
+
+		stats_.queueDepthSum += queue_.size();
+		++stats_.queueDepthSamples;
+
+		bool dropped{ false };
+		if (!makeRoom(lock, dropped))
+			return false;
+
+		cv::Mat slot;
+		if (!free_.empty())
+		{
+			slot = std::move(free_.back());
+			free_.pop_back();
+		}
+
+		// Copy without the lock, the encoder can take other frames meanwhile
+		lock.unlock();
+		frame.copyTo(slot);
+		lock.lock();
+
+		// Other producers may have filled the place meanwhile, or release() closed the writer
+		if (!makeRoom(lock, dropped))
+		{
+			free_.push_back(std::move(slot));
+			return false;
+		}
+
+		queue_.push_back(std::move(slot));
+		stats_.peakQueueDepth = std::max(stats_.peakQueueDepth, queue_.size());
+
+		lock.unlock();
+		frameAvailable_.notify_one();
+		return !dropped;
+	}
+
+	/**
+	 * \brief Encode all queued frames, stop the encoder thread and close the file.
+	 */
+	void release()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			closed_ = true;
+		}
+		frameAvailable_.notify_all();
+		spaceAvailable_.notify_all();
+
+		if (encoder_.joinable())
+			encoder_.join();
+		writer_.release();
+	}
+
+	VideoWriterStats stats() const
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		return stats_;
+	}
+
+private:
+	/**
+	 * \brief Make a place in the queue according to the policy, the lock is held.
+	 * \param dropped Set to true if a queued frame was dropped.
+	 * \return False if the writer was closed.
+	 */
+	bool makeRoom(std::unique_lock<std::mutex>& lock, bool& dropped)
+	{
+		if (closed_)
+			return false;
+
+		if (queue_.size() < capacity_)
+			return true;
+
+		if (policy_ == QueuePolicy::DropOldest)
+		{
+			// Reuse the memory of the dropped frame
+			free_.push_back(std::move(queue_.front()));
+			queue_.pop_front();
+			++stats_.dropped;
+			dropped = true;
+			return true;
+		}
+
+		auto start{ std::chrono::steady_clock::now() };
+		spaceAvailable_.wait(lock, [this] { return closed_ or queue_.size() < capacity_; });
+		stats_.blockedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return !closed_;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		while (true)
+		{
+			frameAvailable_.wait(lock, [this] { return closed_ or !queue_.empty(); });
+
+			// After release() the queue is still written completely
+			if (queue_.empty())
+				return;
+
+			cv::Mat frame{ std::move(queue_.front()) };
+			queue_.pop_front();
+			spaceAvailable_.notify_one();
+
+			lock.unlock();
+			auto start{ std::chrono::steady_clock::now() };
+			writer_.write(frame);
+			double encodeMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+			lock.lock();
+
+			++stats_.written;
+			stats_.encodeMs += encodeMs;
+			stats_.maxEncodeMs = std::max(stats_.maxEncodeMs, encodeMs);
+
+			// Keep the buffer for the next write()
+			if (free_.size() < capacity_)
+				free_.push_back(std::move(frame));
+		}
+	}
+
+	cv::VideoWriter writer_;
+	const size_t capacity_;
+	const QueuePolicy policy_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable frameAvailable_;
+	std::condition_variable spaceAvailable_;
+	std::deque<cv::Mat> queue_;
+	std::vector<cv::Mat> free_; // preallocated frames
+	bool closed_{ false };
+	VideoWriterStats stats_;
+
+	std::thread encoder_;
+};
+
+/**
+ * \brief Frame rate of the source, cameras and some containers report 0.
+ */
+double sourceFps(cv::VideoCapture& cap, double fallback = 30)
+{
+	double fps{ cap.get(cv::CAP_PROP_FPS) };
+	return (std::isfinite(fps) and fps > 0) ? fps : fallback;
+}
+
+
+int main(int argc, char** argv)
+{
+	const std::string videoPath{ "../data/chaplin.mp4" };
+	const QueuePolicy policy{ (argc > 1 and std::string(argv[1]) == "drop-oldest") ? QueuePolicy::DropOldest : QueuePolicy::Block };
+
+	cv::VideoCapture cap{ videoPath };
+	if (!cap.isOpened())
+	{
+		std::cout << "Error opening video stream or file" << std::endl;
+		return 0;
+	}
+
+	const cv::Size size(static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH)), static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT)));
+	const double fps{ sourceFps(cap) };
+	const int fourcc{ cv::VideoWriter::fourcc('M', 'P', 'G', '4') };
+
+	// Inline cv::VideoWriter
+	int frames{ 0 };
+	cv::Mat frame;
+	auto start{ std::chrono::steady_clock::now() };
+	{
+		cv::VideoWriter out{ "outputChaplinSync.mp4", fourcc, fps, size };
+		while (cap.read(frame))
+		{
+			out.write(frame);
+			++frames;
+		}
+	}
+	double syncMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+	cap.release();
+
+	// AsyncVideoWriter, the loop only decodes and queues
+	cap.open(videoPath);
+	start = std::chrono::steady_clock::now();
+	AsyncVideoWriter out{ "outputChaplinAsync.mp4", fourcc, fps, size, true, 8, policy };
+	if (!out.isOpened())
+	{
+		std::cout << "Error opening the output video" << std::endl;
+		return 0;
+	}
+
+	while (cap.read(frame))
+		out.write(frame);
+	double loopMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	out.release();
+	double asyncMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+	cap.release();
+
+	VideoWriterStats stats{ out.stats() };
+
+	std::cout << "Source: " << size << " at " << fps << " fps, " << frames << " frames" << std::endl;
+	std::cout << "cv::VideoWriter: " << frames * 1000.0 / syncMs << " fps" << std::endl;
+	std::cout << "AsyncVideoWriter: loop " << frames * 1000.0 / loopMs << " fps, until the file was closed "
+		<< frames * 1000.0 / asyncMs << " fps" << std::endl;
+	std::cout << "Written: " << stats.written << ", dropped: " << stats.dropped << ", queue depth: peak "
+		<< stats.peakQueueDepth << ", average " << stats.averageQueueDepth() << std::endl;
+	std::cout << "Encode: average " << stats.averageEncodeMs() << " ms, max " << stats.maxEncodeMs
+		<< " ms, producer blocked " << stats.blockedMs << " ms" << std::endl;
+
+	return 0;
+}
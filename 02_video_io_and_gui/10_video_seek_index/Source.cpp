@@ -0,0 +1,546 @@
+/*
+ * Seek index for videos
+ * 02_properties_of_video jumps in the video with cap.set(cv::CAP_PROP_POS_MSEC, ...) (or cv::CAP_PROP_POS_FRAMES).
+ * The backend does not know where the frames are, so it asks the demuxer for the keyframe before the estimated
+ * position and decodes forward until it thinks it reached the frame. That is slow (every seek decodes up to a whole
+ * GOP, group of pictures, which can be several seconds of video) and with variable frame rate or B-frames the frame
+ * it stops at is often not the one we asked for.
+ *
+ * VideoSeekIndex scans the video once and stores a sidecar file next to it (video.mp4.seekidx):
+ *	- the presentation timestamp of every frame,
+ *	- the numbers of the keyframes, the only frames where decoding can start.
+ * The scan does not decode anything: with OpenCV 4.7+ the FFmpeg backend can return raw packets
+ * (cv::CAP_PROP_FORMAT = -1) and tells if a packet is a keyframe (cv::CAP_PROP_LRF_HAS_KEY_FRAME). Packets come in
+ * decoding order, so the timestamps are sorted to get the order in which the frames are shown. Without that support
+ * the index is built by decoding and contains timestamps only, every frame is then treated as a seek point and the
+ * backend finds the keyframe itself. The packet scan is used only if the sorted timestamps are strictly increasing,
+ * packets without a timestamp (or with repeated ones) would make the frame numbers ambiguous.
+ *
+ * The index is validated by the size and the modification time of the video and rebuilt when they change.
+ *
+ * IndexedVideoReader uses the index to read any frame:
+ *	- the keyframe before the frame is looked up in a table (O(1)),
+ *	- if the reader is already between that keyframe and the frame, it only grabs forward, no seek at all,
+ *	- otherwise it seeks to the timestamp of the keyframe (cv::CAP_PROP_POS_MSEC, nothing is decoded in vain) and
+ *	  grabs forward,
+ *	- the timestamp of the decoded frame is compared with the index, so the frame is the right one even if the
+ *	  backend landed a few frames early. If it landed after the frame, the reader seeks once more to the keyframe
+ *	  before, and fails rather than returning a wrong frame.
+ * readRange() seeks once and reads a range of frames sequentially.
+ *
+ * The program builds (or loads) the index, reads random frames with cap.set(cv::CAP_PROP_POS_FRAMES) and with the
+ * index, and compares the times and the frames with a sequential decode.
+ *
+ * Usage:
+ *	Source [video] [--rebuild]
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// Raw packets with the keyframe flag are available since OpenCV 4.7
+#if (CV_VERSION_MAJOR > 4) or (CV_VERSION_MAJOR == 4 and CV_VERSION_MINOR >= 7)
+#define HAVE_RAW_PACKETS 1
+#else
+#define HAVE_RAW_PACKETS 0
+#endif
+
+/**
+ * Timestamps and keyframes of all frames of a video.
+ */
+class VideoSeekIndex
+{
+public:
+	/**
+	 * \brief Scan the video.
+	 * \param video Video file.
+	 * \return False if the video cannot be opened or has no frames.
+	 */
+	bool build(const std::string& video)
+	{
+		timestamps_.clear();
+		keyframes_.clear();
+		if (!readFileInfo(video, videoSize_, videoTime_))
+			return false;
+
+		if (!buildFromPackets(video) and !buildByDecoding(video))
+			return false;
+
+		cv::VideoCapture cap{ video };
+		fps_ = cap.get(cv::CAP_PROP_FPS);
+
+		buildKeyframeTable();
+		return true;
+	}
+
+	/**
+	 * \brief Write the index to a file.
+	 */
+	bool save(const std::string& file) const
+	{
+		Header header{};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.videoSize = videoSize_;
+		header.videoTime = videoTime_;
+		header.frames = static_cast<uint32_t>(timestamps_.size());
+		header.keyframes = static_cast<uint32_t>(keyframes_.size());
+		header.fps = fps_;
+
+		std::ofstream out{ file, std::ios::binary };
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(timestamps_.data()), timestamps_.size() * sizeof(double));
+		out.write(reinterpret_cast<const char*>(keyframes_.data()), keyframes_.size() * sizeof(int32_t));
+		return static_cast<bool>(out);
+	}
+
+	/**
+	 * \brief Read the index from a file.
+	 * \param file Index file.
+	 * \param video The video the index belongs to, the index is rejected if the video changed.
+	 */
+	bool load(const std::string& file, const std::string& video)
+	{
+		std::ifstream in{ file, std::ios::binary };
+		Header header{};
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) or header.magic != MAGIC or header.version != VERSION)
+			return false;
+
+		uint64_t size{ 0 };
+		int64_t time{ 0 };
+		if (!readFileInfo(video, size, time) or size != header.videoSize or time != header.videoTime or header.frames == 0)
+			return false;
+
+		if (header.keyframes > header.frames)
+			return false;
+
+		timestamps_.resize(header.frames);
+		keyframes_.resize(header.keyframes);
+		in.read(reinterpret_cast<char*>(timestamps_.data()), timestamps_.size() * sizeof(double));
+		in.read(reinterpret_cast<char*>(keyframes_.data()), keyframes_.size() * sizeof(int32_t));
+		if (!in)
+			return false;
+
+		// The keyframe table is indexed by the keyframes, a damaged file must not point outside of the video
+		for (size_t i{ 0 }; i < keyframes_.size(); ++i)
+			if (keyframes_[i] < 0 or keyframes_[i] >= static_cast<int32_t>(header.frames) or (i > 0 and keyframes_[i] <= keyframes_[i - 1]))
+				return false;
+
+		videoSize_ = size;
+		videoTime_ = time;
+		fps_ = header.fps;
+		buildKeyframeTable();
+		return true;
+	}
+
+	/**
+	 * \brief Load the sidecar index of the video, build and save it if it is missing or outdated.
+	 */
+	bool loadOrBuild(const std::string& video, bool rebuild = false)
+	{
+		const std::string file{ video + ".seekidx" };
+		if (!rebuild and load(file, video))
+			return true;
+
+		if (!build(video))
+			return false;
+
+		save(file);
+		return true;
+	}
+
+	int frameCount() const
+	{
+		return static_cast<int>(timestamps_.size());
+	}
+
+	int keyframeCount() const
+	{
+		return static_cast<int>(keyframes_.size());
+	}
+
+	double fps() const
+	{
+		return fps_;
+	}
+
+	/**
+	 * \brief Presentation time of a frame in milliseconds.
+	 */
+	double timestampMs(int frame) const
+	{
+		return timestamps_[frame];
+	}
+
+	/**
+	 * \brief Last frame at or before frame where decoding can start.
+	 */
+	int keyframeBefore(int frame) const
+	{
+		return keyframeOf_[frame];
+	}
+
+private:
+	static constexpr uint32_t MAGIC{ 0x58444B53 }; // "SKDX"
+	static constexpr uint32_t VERSION{ 1 };
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t videoSize;
+		int64_t videoTime;
+		uint32_t frames;
+		uint32_t keyframes;
+		double fps;
+	};
+
+	static bool readFileInfo(const std::string& video, uint64_t& size, int64_t& time)
+	{
+		std::error_code error;
+		size = std::filesystem::file_size(video, error);
+		if (error)
+			return false;
+
+		time = static_cast<int64_t>(std::filesystem::last_write_time(video, error).time_since_epoch().count());
+		return !error;
+	}
+
+	bool buildFromPackets(const std::string& video)
+	{
+#if HAVE_RAW_PACKETS
+		cv::VideoCapture cap;
+		if (!cap.open(video, cv::CAP_FFMPEG, { cv::CAP_PROP_FORMAT, -1 }))
+			return false;
+
+		// Packets are in decoding order, B-frames are shown before the frames they were decoded after
+		std::vector<double> packetTimes;
+		std::vector<double> keyframeTimes;
+		while (cap.grab())
+		{
+			const double time{ cap.get(cv::CAP_PROP_POS_MSEC) };
+			packetTimes.push_back(time);
+			if (cap.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) > 0)
+				keyframeTimes.push_back(time);
+		}
+
+		// The backend does not report keyframes, decoding gives at least the timestamps
+		if (packetTimes.empty() or keyframeTimes.empty())
+			return false;
+
+		// Frame number = rank of its timestamp, only unique timestamps give every frame its own rank
+		std::sort(packetTimes.begin(), packetTimes.end());
+		if (std::adjacent_find(packetTimes.begin(), packetTimes.end(), std::greater_equal<double>()) != packetTimes.end())
+			return false;
+
+		timestamps_ = packetTimes;
+		for (double time : keyframeTimes)
+			keyframes_.push_back(static_cast<int32_t>(std::lower_bound(timestamps_.begin(), timestamps_.end(), time) - timestamps_.begin()));
+
+		std::sort(keyframes_.begin(), keyframes_.end());
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool buildByDecoding(const std::string& video)
+	{
+		cv::VideoCapture cap{ video };
+		if (!cap.isOpened())
+			return false;
+
+		while (cap.grab())
+			timestamps_.push_back(cap.get(cv::CAP_PROP_POS_MSEC));
+
+		// Unknown keyframes, every frame is a seek point
+		return !timestamps_.empty();
+	}
+
+	void buildKeyframeTable()
+	{
+		keyframeOf_.resize(timestamps_.size());
+		if (keyframes_.empty())
+		{
+			std::iota(keyframeOf_.begin(), keyframeOf_.end(), 0);
+			return;
+		}
+
+		// The first frame is always decodable
+		size_t next{ 0 };
+		int current{ 0 };
+		for (int frame{ 0 }; frame < static_cast<int>(keyframeOf_.size()); ++frame)
+		{
+			while (next < keyframes_.size() and keyframes_[next] <= frame)
+				current = keyframes_[next++];
+			keyframeOf_[frame] = current;
+		}
+	}
+
+	std::vector<double> timestamps_;
+	std::vector<int32_t> keyframes_;
+	std::vector<int32_t> keyframeOf_; // built on load, not stored
+	uint64_t videoSize_{ 0 };
+	int64_t videoTime_{ 0 };
+	double fps_{ 0 };
+};
+
+/**
+ * Frame accurate random access with a VideoSeekIndex.
+ */
+class IndexedVideoReader
+{
+public:
+	IndexedVideoReader(const std::string& video, const VideoSeekIndex& index)
+		: cap_(video), index_(index)
+	{}
+
+	bool isOpened() const
+	{
+		return cap_.isOpened();
+	}
+
+	/**
+	 * \brief Read a frame.
+	 * \param frame Frame number, 0 - frameCount() - 1.
+	 * \param image Output frame.
+	 * \return False if the frame does not exist or cannot be decoded.
+	 */
+	bool read(int frame, cv::Mat& image)
+	{
+		return seekAndGrab(frame) and cap_.retrieve(image);
+	}
+
+	/**
+	 * \brief Read frames first to last (inclusive) with a single seek.
+	 * \param callback Called as callback(frame number, image), returns false to stop.
+	 * \return Number of frames read.
+	 */
+	template<typename Callback>
+	int readRange(int first, int last, Callback callback)
+	{
+		last = std::min(last, index_.frameCount() - 1);
+
+		int count{ 0 };
+		cv::Mat image;
+		for (int frame{ first }; frame <= last; ++frame)
+		{
+			const bool grabbed{ frame == first ? seekAndGrab(frame) : grabNext(frame) };
+			if (!grabbed or !cap_.retrieve(image))
+				break;
+
+			++count;
+			if (!callback(frame, image))
+				break;
+		}
+		return count;
+	}
+
+	size_t seeks() const
+	{
+		return seeks_;
+	}
+
+	size_t grabbedFrames() const
+	{
+		return grabbed_;
+	}
+
+private:
+	/**
+	 * \brief Grab the frame from wherever the reader is. If the backend lands after the frame, seek again to the
+	 * keyframe before its keyframe, once.
+	 */
+	bool seekAndGrab(int frame)
+	{
+		if (frame < 0 or frame >= index_.frameCount() or !cap_.isOpened())
+			return false;
+
+		overshot_ = false;
+		const int keyframe{ index_.keyframeBefore(frame) };
+		if (moveTo(frame, keyframe) and grabNext(frame))
+			return true;
+
+		if (!overshot_ or keyframe == 0)
+			return false;
+
+		return moveTo(frame, index_.keyframeBefore(keyframe - 1)) and grabNext(frame);
+	}
+
+	/**
+	 * \brief Get in front of frame: seek to the keyframe if needed, then grab up to the frame before it.
+	 */
+	bool moveTo(int frame, int keyframe)
+	{
+		// Already between the keyframe and the frame, grabbing forward is cheaper than any seek
+		if (position_ < keyframe or position_ > frame)
+		{
+			cap_.set(cv::CAP_PROP_POS_MSEC, index_.timestampMs(keyframe));
+			position_ = keyframe;
+			++seeks_;
+		}
+
+		while (position_ < frame)
+		{
+			if (!cap_.grab())
+			{
+				position_ = -1;
+				return false;
+			}
+			++position_;
+			++grabbed_;
+		}
+		return true;
+	}
+
+	/**
+	 * \brief Grab the frame, skip frames if the backend is behind the timestamp from the index.
+	 * \return False if the frame cannot be grabbed or the backend is already past it (overshot_ is set then).
+	 */
+	bool grabNext(int frame)
+	{
+		overshot_ = false;
+		if (!cap_.grab())
+		{
+			position_ = -1;
+			return false;
+		}
+		++grabbed_;
+
+		// Half a frame of tolerance for rounding of the timestamps, at most two seconds are skipped in case the backend
+		// reports different timestamps than the scan
+		const double target{ index_.timestampMs(frame) };
+		const double tolerance{ index_.fps() > 0 ? 500.0 / index_.fps() : 1.0 };
+		const int maxSkipped{ index_.fps() > 0 ? static_cast<int>(2 * index_.fps()) : 60 };
+		double time{ cap_.get(cv::CAP_PROP_POS_MSEC) };
+		for (int skipped{ 0 }; skipped < maxSkipped and time < target - tolerance; ++skipped)
+		{
+			if (!cap_.grab())
+			{
+				position_ = -1;
+				return false;
+			}
+			++grabbed_;
+			time = cap_.get(cv::CAP_PROP_POS_MSEC);
+		}
+
+		// Still early after the skipped frames, or the seek went past the frame: the position is unknown, the next read
+		// seeks again
+		if (std::abs(time - target) > tolerance)
+		{
+			overshot_ = time > target;
+			position_ = -1;
+			return false;
+		}
+
+		position_ = frame + 1;
+		return true;
+	}
+
+	cv::VideoCapture cap_;
+	const VideoSeekIndex& index_;
+	int position_{ 0 }; // number of the next frame grab() returns, -1 if unknown
+	bool overshot_{ false }; // the last grabNext() landed after its frame
+	size_t seeks_{ 0 };
+	size_t grabbed_{ 0 };
+};
+
+
+int main(int argc, char** argv)
+{
+	std::string video{ "../data/chaplin.mp4" };
+	bool rebuild{ false };
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--rebuild")
+			rebuild = true;
+		else
+			video = argv[i];
+	}
+
+	auto start{ std::chrono::steady_clock::now() };
+	VideoSeekIndex index;
+	if (!index.loadOrBuild(video, rebuild))
+	{
+		std::cout << "Error opening video stream or file" << std::endl;
+		return 0;
+	}
+	double indexMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	std::cout << "Index: " << index.frameCount() << " frames, " << index.keyframeCount() << " keyframes, " << index.fps()
+		<< " fps, built or loaded in " << indexMs << " ms" << std::endl;
+
+	// Random frames, fixed seed
+	cv::RNG rng(42);
+	std::vector<int> frames;
+	for (int i{ 0 }; i < 30; ++i)
+		frames.push_back(rng.uniform(0, index.frameCount()));
+
+	// Reference: sequential decode of the whole video
+	std::map<int, cv::Mat> reference;
+	{
+		std::vector<int> sorted{ frames };
+		std::sort(sorted.begin(), sorted.end());
+
+		cv::VideoCapture cap{ video };
+		cv::Mat image;
+		size_t next{ 0 };
+		for (int frame{ 0 }; next < sorted.size() and cap.read(image); ++frame)
+			for (; next < sorted.size() and sorted[next] == frame; ++next)
+				reference[frame] = image.clone();
+	}
+
+	auto same = [&](int frame, const cv::Mat& image)
+		{
+			auto found{ reference.find(frame) };
+			return found != reference.end() and image.size() == found->second.size() and cv::norm(image, found->second, cv::NORM_INF) == 0;
+		};
+
+	// cv::CAP_PROP_POS_FRAMES
+	cv::VideoCapture cap{ video };
+	cv::Mat image;
+	int backendCorrect{ 0 };
+	start = std::chrono::steady_clock::now();
+	for (int frame : frames)
+	{
+		cap.set(cv::CAP_PROP_POS_FRAMES, frame);
+		if (cap.read(image) and same(frame, image))
+			++backendCorrect;
+	}
+	double backendMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	// Index
+	IndexedVideoReader reader(video, index);
+	int indexCorrect{ 0 };
+	start = std::chrono::steady_clock::now();
+	for (int frame : frames)
+		if (reader.read(frame, image) and same(frame, image))
+			++indexCorrect;
+	double readerMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	std::cout << "cv::CAP_PROP_POS_FRAMES: " << backendMs / frames.size() << " ms per frame, " << backendCorrect << " / "
+		<< frames.size() << " correct frames" << std::endl;
+	std::cout << "IndexedVideoReader: " << readerMs / frames.size() << " ms per frame, " << indexCorrect << " / "
+		<< frames.size() << " correct frames, " << reader.seeks() << " seeks, " << reader.grabbedFrames() << " grabbed frames" << std::endl;
+
+	// Range read, eg. one second from the middle
+	const int first{ index.frameCount() / 2 };
+	const int count{ std::max(1, static_cast<int>(index.fps())) };
+	int read{ reader.readRange(first, first + count - 1, [](int, const cv::Mat&) { return true; }) };
+	std::cout << "Range " << first << " - " << first + count - 1 << ": " << read << " frames" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * Playback with deadlines
+ * The video lessons pace the playback with a fixed pause after every frame:
+ *	cap >> frame;
+ *	process(frame);
+ *	cv::imshow("Frame", frame);
+ *	cv::waitKey(25);
+ * The time of a frame is then decode + processing + 25 ms. A fast frame still waits the whole 25 ms (the video plays
+ * slower than it should) and a slow frame adds its whole processing time on top (the video falls further behind with
+ * every slow frame and never catches up).
+ *
+ * PlaybackScheduler instead gives every frame a deadline on the wall clock: frame n has to be shown at
+ * start + n / fps. The loop then:
+ *	- waits with cv::waitKey only for the time left until the deadline, so the window and the keyboard stay responsive
+ *	  and a slow frame does not delay the following ones,
+ *	- skips frames which are already late by more than one frame period: they are only grabbed (cap.grab() without
+ *	  cap.retrieve()), so the conversion of the frame and the processing are not paid for frames nobody would see.
+ *	  With the FFmpeg backend grab() still decodes (the next frames depend on it), but the color conversion and the
+ *	  processing are skipped, which is usually the larger part,
+ *	- pause (space) moves the start, so the playback continues where it stopped instead of skipping the paused time.
+ *
+ * At the end the program prints the number of shown and dropped frames, how late the frames were shown compared
+ * with their deadline and the latency from the start of reading the frame until it was on the screen.
+ *
+ * The processing has a random cost (like a detector whose time depends on the content). Run the program with
+ * "fixed" to see the same video with the waitKey(25) loop of the lessons.
+ *
+ * Usage:
+ *	Source [fixed]
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * Wall clock deadlines for frames played at a fixed frame rate.
+ */
+class PlaybackScheduler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * \param fps Frame rate of the source.
+	 * \param maxLateFrames A frame later than this many frame periods is dropped.
+	 */
+	explicit PlaybackScheduler(double fps, double maxLateFrames = 1.0)
+		: period_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps))),
+		maxLate_(std::chrono::duration_cast<Clock::duration>(period_ * maxLateFrames)), start_(Clock::now())
+	{}
+
+	/**
+	 * \brief Time when the frame should be on the screen.
+	 */
+	Clock::time_point deadline(int frame) const
+	{
+		return start_ + period_ * frame;
+	}
+
+	/**
+	 * \brief The frame would be shown too late, skip it.
+	 */
+	bool isLate(int frame) const
+	{
+		return Clock::now() > deadline(frame) + maxLate_;
+	}
+
+	/**
+	 * \brief Milliseconds until the deadline, at least 1 (cv::waitKey(0) would wait forever).
+	 */
+	int waitMs(int frame) const
+	{
+		auto remaining{ std::chrono::duration_cast<std::chrono::milliseconds>(deadline(frame) - Clock::now()).count() };
+		return static_cast<int>(std::max<long long>(1, remaining));
+	}
+
+	/**
+	 * \brief pause() and resume() move all deadlines by the time the playback was paused.
+	 */
+	void pause()
+	{
+		pausedAt_ = Clock::now();
+	}
+
+	void resume()
+	{
+		start_ += Clock::now() - pausedAt_;
+	}
+
+private:
+	Clock::duration period_;
+	Clock::duration maxLate_;
+	Clock::time_point start_;
+	Clock::time_point pausedAt_;
+};
+
+struct PlaybackStats
+{
+	int shown{ 0 };
+	int dropped{ 0 };
+	std::vector<double> latenessMs; // shown - deadline
+	std::vector<double> latencyMs;  // shown - start of reading the frame
+};
+
+/**
+ * \brief Processing with variable cost: most frames are cheap, some are several times slower.
+ */
+void processFrame(cv::Mat& frame, cv::RNG& rng)
+{
+	const int passes{ rng.uniform(0, 10) < 8 ? 1 : 8 };
+	for (int i{ 0 }; i < passes; ++i)
+		cv::GaussianBlur(frame, frame, cv::Size(7, 7), 0);
+}
+
+double percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+		return 0;
+
+	const size_t k{ std::min(values.size() - 1, static_cast<size_t>(p * values.size())) };
+	std::nth_element(values.begin(), values.begin() + k, values.end());
+	return values[k];
+}
+
+double average(const std::vector<double>& values)
+{
+	double sum{ 0 };
+	for (double value : values)
+		sum += value;
+	return values.empty() ? 0 : sum / values.size();
+}
+
+
+int main(int argc, char** argv)
+{
+	const bool fixedPacing{ argc > 1 and std::string(argv[1]) == "fixed" };
+
+	cv::VideoCapture cap{ "../data/chaplin.mp4" };
+	if (!cap.isOpened())
+	{
+		std::cout << "Error opening video stream or file!" << std::endl;
+		return 0;
+	}
+
+	double fps{ cap.get(cv::CAP_PROP_FPS) };
+	if (!(fps > 0))
+		fps = 25;
+
+	using Clock = PlaybackScheduler::Clock;
+	auto elapsedMs = [](Clock::time_point from, Clock::time_point to)
+		{
+			return std::chrono::duration<double, std::milli>(to - from).count();
+		};
+
+	PlaybackScheduler scheduler(fps);
+	PlaybackStats stats;
+	cv::RNG rng(42);
+	cv::Mat frame;
+	const auto playbackStart{ Clock::now() };
+
+	for (int index{ 0 };; ++index)
+	{
+		// Too late for this frame, only advance the video
+		if (!fixedPacing and scheduler.isLate(index))
+		{
+			if (!cap.grab())
+				break;
+			++stats.dropped;
+			continue;
+		}
+
+		const auto readStart{ Clock::now() };
+		if (!cap.read(frame))
+			break;
+
+		processFrame(frame, rng);
+
+		// Deadline pacing waits before showing the frame (keys are handled meanwhile), fixed pacing after it. waitKey
+		// returns at the first key, so it is called again until the deadline, the last key wins (ESC quits right away)
+		int key{ -1 };
+		while (!fixedPacing and key != 27)
+		{
+			const int pressed{ cv::waitKey(scheduler.waitMs(index)) };
+			if (pressed != -1)
+				key = pressed;
+			if (Clock::now() >= scheduler.deadline(index))
+				break;
+		}
+
+		cv::imshow("Frame", frame);
+		int shownKey{ cv::waitKey(1) }; // paints the window
+		if (key == -1)
+			key = shownKey;
+
+		const auto shown{ Clock::now() };
+		++stats.shown;
+		stats.latencyMs.push_back(elapsedMs(readStart, shown));
+		if (!fixedPacing)
+			stats.latenessMs.push_back(elapsedMs(scheduler.deadline(index), shown));
+
+		if (fixedPacing and key == -1)
+			key = cv::waitKey(24);
+
+		if (key == 27)
+			break;
+
+		// Space pauses until the next key
+		if (key == ' ')
+		{
+			scheduler.pause();
+			cv::waitKey(0);
+			scheduler.resume();
+		}
+	}
+
+	const double playbackMs{ elapsedMs(playbackStart, Clock::now()) };
+	const int frames{ stats.shown + stats.dropped };
+
+	cap.release();
+	cv::destroyAllWindows();
+
+	std::cout << (fixedPacing ? "Fixed waitKey(25) pacing" : "Deadline pacing") << std::endl;
+	std::cout << "Video: " << frames << " frames at " << fps << " fps = " << frames * 1000.0 / fps << " ms, played in "
+		<< playbackMs << " ms (pauses included)" << std::endl;
+	std::cout << "Shown: " << stats.shown << ", dropped: " << stats.dropped << std::endl;
+	if (!fixedPacing)
+		std::cout << "Lateness: average " << average(stats.latenessMs) << " ms, p95 " << percentile(stats.latenessMs, 0.95)
+			<< " ms" << std::endl;
+	std::cout << "Latency (read to screen): average " << average(stats.latencyMs) << " ms, p95 "
+		<< percentile(stats.latencyMs, 0.95) << " ms" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,547 @@
+/*
+ * Layered annotation
+ * 05_use_mouse_for_annotation and 06_annotation_homework draw the shapes directly into the image and show the whole
+ * image after every mouse event. Clearing means copying the original image back, there is no undo, and for a big image
+ * (a 50 MP microscope image) every event costs a full copy and a full cv::imshow.
+ *
+ * Here the image is never touched:
+ *	- annotations are shapes (circles, rectangles) kept in layers. A layer rasterizes its shapes into sparse tiles of
+ *	  256x256 BGRA pixels, tiles are allocated only where something was drawn, so an empty or sparse layer costs
+ *	  almost no memory. The colors are premultiplied by alpha (drawing with alpha 255 onto a transparent tile
+ *	  produces exactly that with cv::LINE_AA), so blending is one multiply-add per channel,
+ *	- every change marks the rectangle it affects as dirty. The compositor keeps a display buffer (image with the
+ *	  visible layers blended over it) and only recomposes the dirty rectangles: copy of the image, then the tiles of
+ *	  the visible layers blended on top (SIMD),
+ *	- undo removes the last shape of a layer and redraws only its bounding rectangle from the remaining shapes, hiding
+ *	  or clearing a layer only marks the area of its shapes,
+ *	- the window shows a viewport of the display buffer (pan with w, a, s, d), cv::imshow is called only when the
+ *	  viewport changed, and then only with the viewport, not with the whole image.
+ *
+ * Keys:
+ *	drag with the left button - draw a circle (center, radius) or a rectangle (corners)
+ *	r - switch between circles and rectangles
+ *	u - undo
+ *	h - hide / show the annotations
+ *	c - clear the annotations
+ *	w, a, s, d - move the viewport
+ *	ESC - exit
+ *
+ * Usage:
+ *	Source [image] [upscale factor]
+ * The upscale factor makes a big test image from a small one, eg. "Source ../data/boy.jpg 10".
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// div255() and blendPremultipliedRow() are copied from 01_getting_started/19_application_sunglesses_filter_better_verison,
+// blendPremultipliedRow() is its overlayBGRARow<true> (premultiplied overlay)
+inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 div255(const cv::v_uint16x8& x)
+{
+	cv::v_uint16x8 t{ cv::v_add_wrap(x, cv::v_setall_u16(128)) };
+	return cv::v_shr<8>(cv::v_add_wrap(t, cv::v_shr<8>(t)));
+}
+#endif
+
+/**
+ * \brief Blend premultiplied BGRA pixels over BGR pixels: dst = dst * (255 - alpha) / 255 + color.
+ * \param dst BGR pixels.
+ * \param overlay Premultiplied BGRA pixels.
+ * \param width Number of pixels.
+ */
+void blendPremultipliedRow(uchar* dst, const uchar* overlay, int width)
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint8x16 zero{ cv::v_setzero_u8() };
+	const cv::v_uint8x16 maxAlpha{ cv::v_setall_u8(255) };
+
+	for (; x <= width - 16; x += 16)
+	{
+		cv::v_uint8x16 c[3], a;
+		cv::v_load_deinterleave(overlay + 4 * x, c[0], c[1], c[2], a);
+
+		// Transparent, the most common case
+		if (!cv::v_check_any(a != zero))
+			continue;
+
+		cv::v_uint8x16 d[3];
+		cv::v_load_deinterleave(dst + 3 * x, d[0], d[1], d[2]);
+
+		cv::v_uint8x16 inverse{ maxAlpha - a };
+		for (int k{ 0 }; k < 3; ++k)
+		{
+			cv::v_uint16x8 low, high;
+			cv::v_mul_expand(d[k], inverse, low, high);
+			d[k] = cv::v_pack(div255(low), div255(high)) + c[k]; // saturating
+		}
+
+		cv::v_store_interleave(dst + 3 * x, d[0], d[1], d[2]);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		const uchar* o{ overlay + 4 * x };
+		if (o[3] == 0)
+			continue;
+
+		uchar* d{ dst + 3 * x };
+		for (int k{ 0 }; k < 3; ++k)
+			d[k] = static_cast<uchar>(std::min(255, div255(d[k] * (255 - o[3])) + o[k]));
+	}
+}
+
+struct Annotation
+{
+	enum Kind
+	{
+		Circle,    // center a, point on the circumference b
+		Rectangle, // corners a and b
+	};
+
+	Kind kind;
+	cv::Point a;
+	cv::Point b;
+	cv::Scalar color;
+	int thickness;
+
+	int radius() const
+	{
+		return cvRound(std::hypot(b.x - a.x, b.y - a.y));
+	}
+
+	/**
+	 * \brief Pixels the annotation can touch, including the thickness and anti-aliasing.
+	 */
+	cv::Rect bounds() const
+	{
+		const int margin{ thickness / 2 + 2 };
+		cv::Rect rect;
+		if (kind == Circle)
+			rect = cv::Rect(a.x - radius(), a.y - radius(), 2 * radius() + 1, 2 * radius() + 1);
+		else
+			rect = cv::Rect(cv::Point(std::min(a.x, b.x), std::min(a.y, b.y)), cv::Point(std::max(a.x, b.x) + 1, std::max(a.y, b.y) + 1));
+
+		return cv::Rect(rect.x - margin, rect.y - margin, rect.width + 2 * margin, rect.height + 2 * margin);
+	}
+
+	/**
+	 * \brief Draw into a BGRA image whose top left pixel is at origin in image coordinates.
+	 */
+	void draw(cv::Mat& bgra, const cv::Point& origin) const
+	{
+		const cv::Scalar opaque(color[0], color[1], color[2], 255);
+		if (kind == Circle)
+			cv::circle(bgra, a - origin, radius(), opaque, thickness, cv::LINE_AA);
+		else
+			cv::rectangle(bgra, a - origin, b - origin, opaque, thickness, cv::LINE_AA);
+	}
+};
+
+/**
+ * Shapes of one layer rasterized into sparse premultiplied BGRA tiles.
+ */
+class AnnotationLayer
+{
+public:
+	static constexpr int TILE_SIZE{ 256 };
+
+	explicit AnnotationLayer(cv::Size imageSize)
+		: imageSize_(imageSize)
+	{}
+
+	/**
+	 * \brief Add and draw a shape.
+	 * \return Dirty rectangle.
+	 */
+	cv::Rect add(const Annotation& annotation)
+	{
+		annotations_.push_back(annotation);
+
+		const cv::Rect area{ annotation.bounds() & cv::Rect(cv::Point(), imageSize_) };
+		forEachTile(area, true, [&](cv::Mat& tile, const cv::Rect& part, const cv::Point& origin)
+			{
+				cv::Mat roi{ tile(part - origin) };
+				annotation.draw(roi, part.tl());
+			});
+		return area;
+	}
+
+	/**
+	 * \brief Remove the last shape and redraw its area from the remaining ones.
+	 * \return Dirty rectangle, empty if there was nothing to undo.
+	 */
+	cv::Rect undo()
+	{
+		if (annotations_.empty())
+			return cv::Rect();
+
+		const cv::Rect area{ annotations_.back().bounds() & cv::Rect(cv::Point(), imageSize_) };
+		annotations_.pop_back();
+
+		forEachTile(area, false, [&](cv::Mat& tile, const cv::Rect& part, const cv::Point& origin)
+			{
+				cv::Mat roi{ tile(part - origin) };
+				roi.setTo(cv::Scalar::all(0));
+				for (const Annotation& annotation : annotations_)
+					if ((annotation.bounds() & part).area() > 0)
+						annotation.draw(roi, part.tl());
+			});
+		return area;
+	}
+
+	/**
+	 * \brief Remove all shapes.
+	 * \return Dirty rectangle.
+	 */
+	cv::Rect clear()
+	{
+		const cv::Rect area{ bounds() };
+		annotations_.clear();
+		tiles_.clear();
+		return area;
+	}
+
+	/**
+	 * \brief Union of the areas of all shapes.
+	 */
+	cv::Rect bounds() const
+	{
+		cv::Rect area;
+		for (const Annotation& annotation : annotations_)
+			area |= annotation.bounds();
+		return area & cv::Rect(cv::Point(), imageSize_);
+	}
+
+	/**
+	 * \brief Blend the layer over an area of a BGR image of the full size.
+	 */
+	void blendInto(cv::Mat& bgr, const cv::Rect& area) const
+	{
+		for (int ty{ area.y / TILE_SIZE }; ty <= (area.br().y - 1) / TILE_SIZE; ++ty)
+			for (int tx{ area.x / TILE_SIZE }; tx <= (area.br().x - 1) / TILE_SIZE; ++tx)
+			{
+				auto found{ tiles_.find(tileKey(tx, ty)) };
+				if (found == tiles_.end())
+					continue;
+
+				const cv::Point origin{ tx * TILE_SIZE, ty * TILE_SIZE };
+				const cv::Rect part{ area & cv::Rect(origin, found->second.size()) };
+				for (int y{ part.y }; y < part.br().y; ++y)
+					blendPremultipliedRow(bgr.ptr<uchar>(y) + 3 * part.x, found->second.ptr<uchar>(y - origin.y) + 4 * (part.x - origin.x), part.width);
+			}
+	}
+
+	bool visible{ true };
+
+private:
+	static int64_t tileKey(int tx, int ty)
+	{
+		return (static_cast<int64_t>(ty) << 32) | static_cast<uint32_t>(tx);
+	}
+
+	/**
+	 * \brief Call function(tile, part of area in the tile, tile origin) for every tile of the area.
+	 * \param allocate Create missing tiles, otherwise they are skipped.
+	 */
+	template<typename Function>
+	void forEachTile(const cv::Rect& area, bool allocate, Function function)
+	{
+		if (area.empty())
+			return;
+
+		for (int ty{ area.y / TILE_SIZE }; ty <= (area.br().y - 1) / TILE_SIZE; ++ty)
+			for (int tx{ area.x / TILE_SIZE }; tx <= (area.br().x - 1) / TILE_SIZE; ++tx)
+			{
+				auto found{ tiles_.find(tileKey(tx, ty)) };
+				const cv::Point origin{ tx * TILE_SIZE, ty * TILE_SIZE };
+
+				// Tiles at the right and bottom border are smaller
+				const cv::Rect tileRect{ cv::Rect(origin, cv::Size(TILE_SIZE, TILE_SIZE)) & cv::Rect(cv::Point(), imageSize_) };
+				if (found == tiles_.end())
+				{
+					if (!allocate)
+						continue;
+					found = tiles_.emplace(tileKey(tx, ty), cv::Mat::zeros(tileRect.size(), CV_8UC4)).first;
+				}
+
+				function(found->second, area & tileRect, origin);
+			}
+	}
+
+	cv::Size imageSize_;
+	std::vector<Annotation> annotations_;
+	std::map<int64_t, cv::Mat> tiles_;
+};
+
+/**
+ * Image with annotation layers, keeps the composed image and updates only the dirty rectangles.
+ */
+class Compositor
+{
+public:
+	explicit Compositor(const cv::Mat& image)
+		: image_(image), display_(image.clone())
+	{}
+
+	/**
+	 * \brief Add an empty layer on top.
+	 * \return Index of the layer.
+	 */
+	int addLayer()
+	{
+		layers_.emplace_back(image_.size());
+		return static_cast<int>(layers_.size()) - 1;
+	}
+
+	void add(int layer, const Annotation& annotation)
+	{
+		markDirty(layers_[layer].add(annotation));
+	}
+
+	void undo(int layer)
+	{
+		markDirty(layers_[layer].undo());
+	}
+
+	void clear(int layer)
+	{
+		markDirty(layers_[layer].clear());
+	}
+
+	void setVisible(int layer, bool visible)
+	{
+		if (layers_[layer].visible == visible)
+			return;
+
+		layers_[layer].visible = visible;
+		markDirty(layers_[layer].bounds());
+	}
+
+	bool isVisible(int layer) const
+	{
+		return layers_[layer].visible;
+	}
+
+	/**
+	 * \brief Recompose the dirty rectangles.
+	 * \return Union of the recomposed rectangles (empty if nothing changed).
+	 */
+	cv::Rect compose()
+	{
+		auto start{ std::chrono::steady_clock::now() };
+
+		cv::Rect changed;
+		for (const cv::Rect& rect : dirty_)
+		{
+			image_(rect).copyTo(display_(rect));
+			for (const AnnotationLayer& layer : layers_)
+				if (layer.visible)
+					layer.blendInto(display_, rect);
+
+			composedPixels_ += rect.area();
+			changed |= rect;
+		}
+		dirty_.clear();
+
+		composeMs_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return changed;
+	}
+
+	const cv::Mat& display() const
+	{
+		return display_;
+	}
+
+	double composedPixels() const
+	{
+		return composedPixels_;
+	}
+
+	double composeMs() const
+	{
+		return composeMs_;
+	}
+
+private:
+	/**
+	 * \brief Add a dirty rectangle, rectangles which overlap are merged, so no pixel is composed twice.
+	 */
+	void markDirty(cv::Rect rect)
+	{
+		rect &= cv::Rect(cv::Point(), image_.size());
+		if (rect.empty())
+			return;
+
+		for (bool merged{ true }; merged;)
+		{
+			merged = false;
+			for (size_t i{ 0 }; i < dirty_.size(); ++i)
+				if ((dirty_[i] & rect).area() > 0)
+				{
+					rect |= dirty_[i];
+					dirty_.erase(dirty_.begin() + i);
+					merged = true;
+					break;
+				}
+		}
+		dirty_.push_back(rect);
+	}
+
+	cv::Mat image_;
+	cv::Mat display_;
+	std::vector<AnnotationLayer> layers_;
+	std::vector<cv::Rect> dirty_;
+	double composedPixels_{ 0 };
+	double composeMs_{ 0 };
+};
+
+// Shared with the mouse callback
+class MouseParams
+{
+public:
+	Compositor* compositor{ nullptr };
+	int annotations{ 0 }; // layer with the finished shapes
+	int preview{ 0 };     // layer with the shape being dragged
+	Annotation::Kind tool{ Annotation::Circle };
+	cv::Point viewport;   // top left corner of the window in the image
+	cv::Point start;
+	bool dragging{ false };
+	bool hasPreview{ false };
+	int events{ 0 };
+};
+
+void onMouse(int action, int x, int y, int flags, void* userdata)
+{
+	auto mp = static_cast<MouseParams*>(userdata);
+	const cv::Point point{ cv::Point(x, y) + mp->viewport };
+	const Annotation shape{ mp->tool, mp->start, point, cv::Scalar(255, 255, 0), 2 };
+
+	if (action == cv::EVENT_LBUTTONDOWN)
+	{
+		mp->start = point;
+		mp->dragging = true;
+	}
+	else if (action == cv::EVENT_MOUSEMOVE and mp->dragging)
+	{
+		// Rubber band: replace the previous preview
+		if (mp->hasPreview)
+			mp->compositor->undo(mp->preview);
+		mp->compositor->add(mp->preview, shape);
+		mp->hasPreview = true;
+		++mp->events;
+	}
+	else if (action == cv::EVENT_LBUTTONUP and mp->dragging)
+	{
+		if (mp->hasPreview)
+			mp->compositor->undo(mp->preview);
+		mp->compositor->add(mp->annotations, shape);
+		mp->dragging = false;
+		mp->hasPreview = false;
+		++mp->events;
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	cv::Mat image{ cv::imread(argc > 1 ? argv[1] : "../data/boy.jpg") };
+	if (image.empty())
+	{
+		std::cout << "Error reading the image!" << std::endl;
+		return 0;
+	}
+
+	if (argc > 2)
+	{
+		const double factor{ std::stod(argv[2]) };
+		cv::resize(image, image, cv::Size(), factor, factor, cv::INTER_LINEAR);
+	}
+
+	Compositor compositor(image);
+	MouseParams mp;
+	mp.compositor = &compositor;
+	mp.annotations = compositor.addLayer();
+	mp.preview = compositor.addLayer();
+
+	const cv::Size windowSize{ std::min(image.cols, 1280), std::min(image.rows, 720) };
+	const int panStep{ 200 };
+
+	cv::namedWindow("Window");
+	cv::setMouseCallback("Window", onMouse, &mp);
+
+	bool viewportMoved{ true };
+	int shownFrames{ 0 };
+	int k{ 0 };
+	while (k != 27)
+	{
+		const cv::Rect viewport{ mp.viewport, windowSize };
+		const cv::Rect changed{ compositor.compose() };
+
+		// Only when the visible part changed, and only the visible part
+		if (viewportMoved or (changed & viewport).area() > 0)
+		{
+			cv::imshow("Window", compositor.display()(viewport));
+			viewportMoved = false;
+			++shownFrames;
+		}
+
+		k = cv::waitKey(10) & 0xFF;
+
+		switch (k)
+		{
+		case 'r':
+			mp.tool = (mp.tool == Annotation::Circle) ? Annotation::Rectangle : Annotation::Circle;
+			break;
+		case 'u':
+			compositor.undo(mp.annotations);
+			break;
+		case 'h':
+			compositor.setVisible(mp.annotations, !compositor.isVisible(mp.annotations));
+			break;
+		case 'c':
+			compositor.clear(mp.annotations);
+			break;
+		case 'w':
+		case 'a':
+		case 's':
+		case 'd':
+		{
+			cv::Point move{ k == 'a' ? -panStep : k == 'd' ? panStep : 0, k == 'w' ? -panStep : k == 's' ? panStep : 0 };
+			mp.viewport.x = std::clamp(mp.viewport.x + move.x, 0, image.cols - windowSize.width);
+			mp.viewport.y = std::clamp(mp.viewport.y + move.y, 0, image.rows - windowSize.height);
+			viewportMoved = true;
+			break;
+		}
+		}
+	}
+
+	cv::destroyAllWindows();
+
+	std::cout << "Image: " << image.size() << ", mouse events: " << mp.events << ", window updates: " << shownFrames << std::endl;
+	std::cout << "Composed " << compositor.composedPixels() / image.total() << " images worth of pixels in "
+		<< compositor.composeMs() << " ms (a full redraw per event would be " << mp.events << ")" << std::endl;
+
+	return 0;
+}
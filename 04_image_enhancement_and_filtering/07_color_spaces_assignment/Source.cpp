@@ -2,13 +2,23 @@
  * Implement from scratch two functions:
  *	1. convertBGRtoGray - function for converting BGR images to Grayscale image.
  *	2. convertBGRtoHSV - function for converting BGR image to HSV image;
+ *
+ * The functions above follow the formulas step by step in floating point. They are followed by fast versions,
+ * which stay in 8-bit, touch every pixel only once and use SIMD instructions (OpenCV universal intrinsics):
+ *	1. convertBGRtoGrayFast - fixed-point BGR to Grayscale conversion with optional contrast stretching.
+ *	2. convertBGRtoHSVFast - branchless BGR to HSV conversion with 8-bit or float output.
  */
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/highgui.hpp>
+#include <array>
+#include <chrono>
 #include <iostream>
 #include <cmath>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 
 void convertBGRtoGray(const cv::Mat& img, cv::Mat& output)
@@ -138,6 +148,339 @@ void convertBGRtoHSV(const cv::Mat& img, cv::Mat& output)
 }
 
 
+// Weights of BGR to Grayscale conversion in fixed point: 0.114, 0.587 and 0.299 scaled by 2^14 (sum is exactly 2^14).
+// The same values are used by cv::cvtColor.
+constexpr int GRAY_SHIFT{ 14 };
+constexpr int GRAY_B{ 1868 };
+constexpr int GRAY_G{ 9617 };
+constexpr int GRAY_R{ 4899 };
+
+/**
+ * \brief Convert one row of BGR pixels to gray: (B * 1868 + G * 9617 + R * 4899 + 2^13) >> 14
+ * \param bgr Pointer to the first BGR pixel of the row.
+ * \param gray Pointer to the first pixel of the output row.
+ * \param width Number of pixels in the row.
+ */
+void convertBGRtoGrayRow(const uchar* bgr, uchar* gray, int width)
+{
+	int w{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint16x8 wb{ cv::v_setall_u16(GRAY_B) };
+	const cv::v_uint16x8 wg{ cv::v_setall_u16(GRAY_G) };
+	const cv::v_uint16x8 wr{ cv::v_setall_u16(GRAY_R) };
+
+	// Weighted sum of 8 pixels expanded to 16-bit, products need 32-bit
+	auto weightedSum = [&](const cv::v_uint16x8& b, const cv::v_uint16x8& g, const cv::v_uint16x8& r)
+	{
+		cv::v_uint32x4 b0, b1, g0, g1, r0, r1;
+		cv::v_mul_expand(b, wb, b0, b1);
+		cv::v_mul_expand(g, wg, g0, g1);
+		cv::v_mul_expand(r, wr, r0, r1);
+
+		// Rounding shift and pack back to 16-bit
+		return cv::v_rshr_pack<GRAY_SHIFT>(b0 + g0 + r0, b1 + g1 + r1);
+	};
+
+	// 16 pixels per iteration
+	for (; w <= width - 16; w += 16)
+	{
+		cv::v_uint8x16 b, g, r;
+		cv::v_load_deinterleave(bgr + 3 * w, b, g, r);
+
+		cv::v_uint16x8 bLow, bHigh, gLow, gHigh, rLow, rHigh;
+		cv::v_expand(b, bLow, bHigh);
+		cv::v_expand(g, gLow, gHigh);
+		cv::v_expand(r, rLow, rHigh);
+
+		cv::v_store(gray + w, cv::v_pack(weightedSum(bLow, gLow, rLow), weightedSum(bHigh, gHigh, rHigh)));
+	}
+#endif
+
+	// Remaining pixels (or all of them without SIMD)
+	for (; w < width; ++w)
+	{
+		const uchar* p{ bgr + 3 * w };
+		gray[w] = static_cast<uchar>((p[0] * GRAY_B + p[1] * GRAY_G + p[2] * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+	}
+}
+
+/**
+ * \brief Fast BGR to Grayscale conversion, 8-bit to 8-bit in a single pass over the image.
+ * Without contrast stretching the result is the same as cv::cvtColor(img, output, cv::COLOR_BGR2GRAY). With contrast
+ * stretching the range [min, max] of gray values is mapped to [0, 255], like cv::normalize with cv::NORM_MINMAX in
+ * convertBGRtoGray. Minimum and maximum are taken from a histogram built during the conversion, the second pass is
+ * a 256-entry look up table, no float image is ever created.
+ * \param img Input image (CV_8UC3, BGR).
+ * \param output Output image (CV_8UC1), allocated if needed.
+ * \param stretchContrast Map the range of gray values to [0, 255].
+ */
+void convertBGRtoGrayFast(const cv::Mat& img, cv::Mat& output, bool stretchContrast = false)
+{
+	CV_Assert(img.type() == CV_8UC3);
+
+	// Keep a header of the input, so it stays valid even if output is the same cv::Mat as img
+	const cv::Mat src{ img };
+	output.create(src.size(), CV_8UC1);
+	cv::Mat& dst{ output };
+
+	std::array<int, 256> histogram{};
+	std::mutex histogramMutex;
+
+	const double nstripes{ std::max(1.0, static_cast<double>(src.total() * src.elemSize()) / (1 << 16)) };
+
+	cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& rows)
+	{
+		std::array<int, 256> localHistogram{};
+
+		for (int h{ rows.start }; h < rows.end; ++h)
+		{
+			uchar* grayRow{ dst.ptr<uchar>(h) };
+			convertBGRtoGrayRow(src.ptr<uchar>(h), grayRow, src.cols);
+
+			// Row is still in the cache, histogram costs almost nothing
+			if (stretchContrast)
+			{
+				for (int w{ 0 }; w < src.cols; ++w)
+					localHistogram[grayRow[w]]++;
+			}
+		}
+
+		if (stretchContrast)
+		{
+			std::lock_guard<std::mutex> lock{ histogramMutex };
+			for (int i{ 0 }; i < 256; ++i)
+				histogram[i] += localHistogram[i];
+		}
+	}, nstripes);
+
+	if (!stretchContrast)
+		return;
+
+	// Minimum and maximum are the first and the last non-empty bins
+	int minValue{ 0 };
+	int maxValue{ 255 };
+	while (minValue < 255 and histogram[minValue] == 0)
+		++minValue;
+	while (maxValue > 0 and histogram[maxValue] == 0)
+		--maxValue;
+
+	// Constant image, cv::normalize gives zeros in that case
+	if (maxValue <= minValue)
+	{
+		dst.setTo(cv::Scalar::all(0));
+		return;
+	}
+
+	cv::Mat lookUpTable(1, 256, CV_8U);
+	uchar* lut{ lookUpTable.ptr() };
+	const double scale{ 255.0 / (maxValue - minValue) };
+	for (int i{ 0 }; i < 256; ++i)
+		lut[i] = cv::saturate_cast<uchar>((i - minValue) * scale);
+
+	// cv::LUT works in-place
+	cv::LUT(dst, lookUpTable, dst);
+}
+
+
+// Tables of reciprocals used by convertBGRtoHSVFast, so no division is done per pixel. Index 0 maps to 0, so
+// black pixels (V = 0) get S = 0 and gray pixels (diff = 0) get H = 0 without any branch.
+struct HSVTables
+{
+	static constexpr int SHIFT{ 12 };
+
+	int saturation[256]; // (255 << 12) / V
+	int hue[256];        // (30 << 12) / diff, 30 = 180 / 6 (hue in range [0, 180))
+	float saturationF[256]; // 1 / V
+	float hueF[256];        // 30 / diff
+
+	HSVTables()
+	{
+		saturation[0] = hue[0] = 0;
+		saturationF[0] = hueF[0] = 0.f;
+
+		for (int i{ 1 }; i < 256; ++i)
+		{
+			saturation[i] = cvRound((255 << SHIFT) / static_cast<double>(i));
+			hue[i] = cvRound((30 << SHIFT) / static_cast<double>(i));
+			saturationF[i] = 1.f / i;
+			hueF[i] = 30.f / i;
+		}
+	}
+};
+
+const HSVTables& hsvTables()
+{
+	static const HSVTables tables;
+	return tables;
+}
+
+/**
+ * \brief Convert one row of BGR pixels to HSV.
+ * The hue follows the assignment: hue = 30 * (g - b) / diff (+180 if negative) when r is the maximum,
+ * 30 * (b - r) / diff + 60 when g is the maximum and 30 * (r - g) / diff + 120 when b is the maximum. The three cases
+ * are written as one numerator (g - b, b - r + 2 * diff, r - g + 4 * diff) chosen with masks instead of branches.
+ * 8-bit output: H in [0, 180), S and V in [0, 255] (the same ranges as cv::cvtColor).
+ * Float output: H in [0, 180), S and V in [0, 1].
+ * \tparam T uchar or float.
+ * \param bgr Pointer to the first BGR pixel of the row.
+ * \param hsv Pointer to the first HSV pixel of the output row (interleaved).
+ * \param width Number of pixels in the row.
+ */
+template<typename T>
+void convertBGRtoHSVRow(const uchar* bgr, T* hsv, int width)
+{
+	const HSVTables& tab{ hsvTables() };
+	constexpr int ROUND{ 1 << (HSVTables::SHIFT - 1) };
+	int w{ 0 };
+
+#if CV_SIMD128
+	const cv::v_int32x4 zero{ cv::v_setzero_s32() };
+	const cv::v_int32x4 round{ cv::v_setall_s32(ROUND) };
+	const cv::v_int32x4 hueRange{ cv::v_setall_s32(180) };
+	const cv::v_float32x4 hueRangeF{ cv::v_setall_f32(180.f) };
+	const cv::v_float32x4 valueScale{ cv::v_setall_f32(1.f / 255) };
+
+	// Split 16 bytes into four vectors of 32-bit integers
+	auto expand = [](const cv::v_uint8x16& v, cv::v_int32x4 out[4])
+	{
+		cv::v_uint16x8 low, high;
+		cv::v_expand(v, low, high);
+
+		cv::v_uint32x4 a, b, c, d;
+		cv::v_expand(low, a, b);
+		cv::v_expand(high, c, d);
+
+		out[0] = cv::v_reinterpret_as_s32(a);
+		out[1] = cv::v_reinterpret_as_s32(b);
+		out[2] = cv::v_reinterpret_as_s32(c);
+		out[3] = cv::v_reinterpret_as_s32(d);
+	};
+
+	// 16 pixels per iteration
+	for (; w <= width - 16; w += 16)
+	{
+		cv::v_uint8x16 b8, g8, r8;
+		cv::v_load_deinterleave(bgr + 3 * w, b8, g8, r8);
+
+		// Value is the maximum, diff is maximum - minimum. Still 16 lanes of 8-bit
+		cv::v_uint8x16 v8{ cv::v_max(b8, cv::v_max(g8, r8)) };
+		cv::v_uint8x16 diff8{ v8 - cv::v_min(b8, cv::v_min(g8, r8)) };
+
+		cv::v_int32x4 b[4], g[4], r[4], v[4], diff[4];
+		expand(b8, b);
+		expand(g8, g);
+		expand(r8, r);
+		expand(v8, v);
+		expand(diff8, diff);
+
+		cv::v_int32x4 hueNumerator[4];
+		for (int k{ 0 }; k < 4; ++k)
+		{
+			cv::v_int32x4 isR{ v[k] == r[k] };
+			cv::v_int32x4 isG{ v[k] == g[k] };
+			cv::v_int32x4 diff2{ diff[k] + diff[k] };
+
+			hueNumerator[k] = cv::v_select(isR, g[k] - b[k],
+				cv::v_select(isG, b[k] - r[k] + diff2, r[k] - g[k] + diff2 + diff2));
+		}
+
+		if constexpr (std::is_same_v<T, uchar>)
+		{
+			cv::v_int32x4 h[4], sat[4];
+			for (int k{ 0 }; k < 4; ++k)
+			{
+				h[k] = (hueNumerator[k] * cv::v_lut(tab.hue, diff[k]) + round) >> HSVTables::SHIFT;
+				h[k] = cv::v_select(h[k] < zero, h[k] + hueRange, h[k]);
+				sat[k] = (diff[k] * cv::v_lut(tab.saturation, v[k]) + round) >> HSVTables::SHIFT;
+			}
+
+			cv::v_uint8x16 h8{ cv::v_pack_u(cv::v_pack(h[0], h[1]), cv::v_pack(h[2], h[3])) };
+			cv::v_uint8x16 s8{ cv::v_pack_u(cv::v_pack(sat[0], sat[1]), cv::v_pack(sat[2], sat[3])) };
+
+			cv::v_store_interleave(hsv + 3 * w, h8, s8, v8);
+		}
+		else
+		{
+			for (int k{ 0 }; k < 4; ++k)
+			{
+				cv::v_float32x4 h{ cv::v_cvt_f32(hueNumerator[k]) * cv::v_lut(tab.hueF, diff[k]) };
+				h = cv::v_select(h < cv::v_setzero_f32(), h + hueRangeF, h);
+				cv::v_float32x4 sat{ cv::v_cvt_f32(diff[k]) * cv::v_lut(tab.saturationF, v[k]) };
+				cv::v_float32x4 value{ cv::v_cvt_f32(v[k]) * valueScale };
+
+				cv::v_store_interleave(hsv + 3 * (w + 4 * k), h, sat, value);
+			}
+		}
+	}
+#endif
+
+	// Remaining pixels (or all of them without SIMD), the same formulas without branches
+	for (; w < width; ++w)
+	{
+		const uchar* p{ bgr + 3 * w };
+		int b{ p[0] }, g{ p[1] }, r{ p[2] };
+		int v{ std::max(b, std::max(g, r)) };
+		int diff{ v - std::min(b, std::min(g, r)) };
+
+		int isR{ -(v == r) };
+		int isG{ -(v == g) };
+		int hueNumerator{ (isR & (g - b)) + (~isR & ((isG & (b - r + 2 * diff)) + (~isG & (r - g + 4 * diff)))) };
+
+		T* out{ hsv + 3 * w };
+		if constexpr (std::is_same_v<T, uchar>)
+		{
+			int h{ (hueNumerator * tab.hue[diff] + ROUND) >> HSVTables::SHIFT };
+			h += (h < 0) * 180;
+			out[0] = static_cast<uchar>(h);
+			out[1] = static_cast<uchar>((diff * tab.saturation[v] + ROUND) >> HSVTables::SHIFT);
+			out[2] = static_cast<uchar>(v);
+		}
+		else
+		{
+			float h{ hueNumerator * tab.hueF[diff] };
+			out[0] = h < 0 ? h + 180.f : h;
+			out[1] = diff * tab.saturationF[v];
+			out[2] = v * (1.f / 255);
+		}
+	}
+}
+
+/**
+ * \brief Fast BGR to HSV conversion. One pass over the image, no temporary images, no split/normalize/merge.
+ * For 8-bit output the result is the same as cv::cvtColor(img, output, cv::COLOR_BGR2HSV).
+ * \param img Input image (CV_8UC3, BGR).
+ * \param output Output image (CV_8UC3 or CV_32FC3, interleaved HSV), allocated if needed.
+ * \param depth Depth of the output: CV_8U (H in [0, 180), S, V in [0, 255]) or CV_32F (H in [0, 180), S, V in [0, 1]).
+ */
+void convertBGRtoHSVFast(const cv::Mat& img, cv::Mat& output, int depth = CV_8U)
+{
+	CV_Assert(img.type() == CV_8UC3);
+	CV_Assert(depth == CV_8U or depth == CV_32F);
+
+	// Keep a header of the input, so it stays valid even if output is the same cv::Mat as img
+	const cv::Mat src{ img };
+	output.create(src.size(), CV_MAKETYPE(depth, 3));
+	cv::Mat& dst{ output };
+
+	// Make sure tables are built before the threads start
+	hsvTables();
+
+	const double nstripes{ std::max(1.0, static_cast<double>(src.total() * src.elemSize()) / (1 << 16)) };
+
+	cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& rows)
+	{
+		for (int h{ rows.start }; h < rows.end; ++h)
+		{
+			if (depth == CV_8U)
+				convertBGRtoHSVRow(src.ptr<uchar>(h), dst.ptr<uchar>(h), src.cols);
+			else
+				convertBGRtoHSVRow(src.ptr<uchar>(h), dst.ptr<float>(h), src.cols);
+		}
+	}, nstripes);
+}
+
+
 int main()
 {
 	// Load an image from disk
@@ -155,6 +498,34 @@ int main()
 	cv::waitKey(0);
 	cv::destroyAllWindows();
 
+	// Fast grayscale conversion, plain and with contrast stretching
+	cv::Mat grayFast;
+	cv::Mat grayFastStretched;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	convertBGRtoGray(image, gray);
+	auto stop = std::chrono::high_resolution_clock::now();
+	std::cout << "convertBGRtoGray: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	convertBGRtoGrayFast(image, grayFast);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "convertBGRtoGrayFast: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	convertBGRtoGrayFast(image, grayFastStretched, true);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "convertBGRtoGrayFast (contrast stretch): " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	// Maximum difference against OpenCV and against the float implementation
+	std::cout << "Max difference fast vs OpenCV: " << cv::norm(grayFast, grayOpenCV, cv::NORM_INF) << std::endl;
+	std::cout << "Max difference fast (stretched) vs float: " << cv::norm(grayFastStretched, gray, cv::NORM_INF) << std::endl;
+
+	cv::imshow("Grayscale fast", grayFast);
+	cv::imshow("Grayscale fast (contrast stretch)", grayFastStretched);
+	cv::waitKey(0);
+	cv::destroyAllWindows();
+
 	// Output image in HSV color space
 	cv::Mat hsv;
 	cv::Mat hsvOpenCV;
@@ -166,6 +537,33 @@ int main()
 	cv::imshow("HSV OpenCV", hsvOpenCV);
 	cv::waitKey(0);
 	cv::destroyAllWindows();
+
+	// Fast HSV conversion
+	cv::Mat hsvFast;
+	cv::Mat hsvFastFloat;
+
+	start = std::chrono::high_resolution_clock::now();
+	convertBGRtoHSV(image, hsv);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "convertBGRtoHSV: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	convertBGRtoHSVFast(image, hsvFast);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "convertBGRtoHSVFast: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	start = std::chrono::high_resolution_clock::now();
+	cv::cvtColor(image, hsvOpenCV, cv::COLOR_BGR2HSV);
+	stop = std::chrono::high_resolution_clock::now();
+	std::cout << "cv::cvtColor: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start) << std::endl;
+
+	convertBGRtoHSVFast(image, hsvFastFloat, CV_32F);
+
+	std::cout << "Max difference fast vs OpenCV: " << cv::norm(hsvFast, hsvOpenCV, cv::NORM_INF) << std::endl;
+
+	cv::imshow("HSV fast", hsvFast);
+	cv::waitKey(0);
+	cv::destroyAllWindows();
 	
 
 	return 0;
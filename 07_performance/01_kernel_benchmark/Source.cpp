@@ -0,0 +1,673 @@
+/*
+ * Kernel benchmark
+ * The lessons contain a few hand-written kernels and the only place where we measure anything is a single
+ * std::chrono sample in the thresholding lesson. One sample tells us nothing: the first call pays for page faults
+ * and cold caches, and a single run hides the noise of the machine. This program is a small benchmark harness that
+ * runs every hand-written kernel of the course:
+ *	- thresholdingUsingForLoop (03_binary_image_processing/01_thresholding),
+ *	- convertBGRtoGray and convertBGRtoHSV (04_image_enhancement_and_filtering/07_color_spaces_assignment),
+ *	- interp together with the cv::LUT pass it feeds (04_image_enhancement_and_filtering/10_color_adjustment_using_curves),
+ *	- getSobelScore (06_project/02_blemish_removal),
+ *	- var_abs_laplacian and sum_modified_laplacian (04_image_enhancement_and_filtering/21_auto_focus_assignment).
+ *
+ * Every kernel is executed over a sweep of resolutions (VGA up to 8K) and OpenCV thread counts. For each case we run a
+ * few warm-up iterations, then a number of timed repetitions, and report the median and the 99th percentile (p99).
+ * The median is robust against outliers, p99 shows how bad the tail is.
+ *
+ * Results are printed as a table and written as JSON, so they can be compared between commits or machines.
+ *
+ * Usage:
+ *	Source [--reps N] [--warmup N] [--resolutions VGA,HD,FHD,4K,8K] [--threads 1,2,4] [--filter name] [--out file.json]
+ *
+ * The kernels below are copies of the lesson code (every lesson is a standalone program), keep them in sync when a
+ * lesson changes.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Kernels under test
+// ---------------------------------------------------------------------------------------------------------------------
+
+// 03_binary_image_processing/01_thresholding
+void thresholdingUsingForLoop(const cv::Mat& src, cv::Mat& dst, int thresh, int maxValue)
+{
+	auto [width, height] = src.size();
+
+	// Loop over rows
+	for(int i{0}; i < height; ++i)
+	{
+		// Loop over columns
+		for(int j{0}; j < width; ++j)
+		{
+			if (src.at<uchar>(i, j) > thresh)
+				dst.at<uchar>(i, j) = maxValue;
+			else
+				dst.at<uchar>(i, j) = 0;
+		}
+	}
+}
+
+// 04_image_enhancement_and_filtering/07_color_spaces_assignment
+void convertBGRtoGray(const cv::Mat& img, cv::Mat& output)
+{
+	cv::Mat imClone{ img.clone() };
+	auto [width, height] = img.size();
+
+	imClone.convertTo(imClone, CV_32F);
+	cv::normalize(imClone, imClone, 0, 1, cv::NORM_MINMAX);
+
+	cv::Mat m { height, width, CV_32FC1, 0.0 };
+
+	for(int h{0}; h < height; ++h)
+	{
+		for(int w{0}; w < width; ++w)
+		{
+			float b{ imClone.at<cv::Vec3f>(h, w)[0] };
+			float g{ imClone.at<cv::Vec3f>(h, w)[1] };
+			float r{ imClone.at<cv::Vec3f>(h, w)[2] };
+
+			m.at<float>(h, w) = 0.299 * r + 0.587 * g + 0.114 * b;
+		}
+	}
+
+	cv::normalize(m, m, 0, 255, cv::NORM_MINMAX, CV_8UC1);
+
+	output = m;
+}
+
+// 04_image_enhancement_and_filtering/07_color_spaces_assignment
+void convertBGRtoHSV(const cv::Mat& img, cv::Mat& output)
+{
+	cv::Mat imClone{ img.clone() };
+	auto [width, height] = img.size();
+
+	imClone.convertTo(imClone, CV_32F);
+	cv::normalize(imClone, imClone, 0, 1, cv::NORM_MINMAX);
+
+	cv::Mat hsv{ height, width, CV_32FC3, 0.0 };
+
+	for(int h{0}; h < height; ++h)
+	{
+		for(int w{0}; w < width; ++w)
+		{
+			double b{ imClone.at<cv::Vec3f>(h, w)[0] };
+			double g{ imClone.at<cv::Vec3f>(h, w)[1] };
+			double r{ imClone.at<cv::Vec3f>(h, w)[2] };
+
+			double hue{ -1 };
+			double saturation{ -1 };
+
+			double colorMax{ std::max(r, std::max(g, b)) };
+			double colorMin{ std::min(r, std::min(g, b)) };
+			double diff{ colorMax - colorMin };
+
+			if (colorMax == colorMin)
+				hue = 0;
+			else if (colorMax == r)
+				hue = std::fmod(30 * ((g - b) / diff) + 180, 180);
+			else if (colorMax == g)
+				hue = std::fmod(30 * ((b - r) / diff) + 60, 180);
+			else if (colorMax == b)
+				hue = std::fmod(30 * ((r - g) / diff) + 120, 180);
+
+			if (colorMax == 0)
+				saturation = 0;
+			else
+				saturation = (diff / colorMax) * 100;
+
+			double value = colorMax * 100;
+
+			hsv.at<cv::Vec3f>(h, w)[0] = hue;
+			hsv.at<cv::Vec3f>(h, w)[1] = saturation;
+			hsv.at<cv::Vec3f>(h, w)[2] = value;
+		}
+	}
+
+	std::vector<cv::Mat> hsvChannels(3);
+	cv::split(hsv, hsvChannels);
+
+	cv::normalize(hsvChannels[0], hsvChannels[0], 0, 179, cv::NORM_MINMAX, CV_8U);
+	cv::normalize(hsvChannels[1], hsvChannels[1], 0, 255, cv::NORM_MINMAX, CV_8U);
+	cv::normalize(hsvChannels[2], hsvChannels[2], 0, 255, cv::NORM_MINMAX, CV_8U);
+
+	cv::merge(hsvChannels, hsv);
+
+	output = hsv;
+}
+
+// 04_image_enhancement_and_filtering/10_color_adjustment_using_curves
+void interp(float* fullRange, float* Curve, float* originalValue, uchar* lut)
+{
+	for(int i{0}; i < 256; ++i)
+	{
+		int j{ 0 };
+		float a{ fullRange[i] };
+		while (a > originalValue[j])
+		{
+			j++;
+		}
+		if(a == originalValue[j])
+		{
+			lut[i] = Curve[j];
+			continue;
+		}
+		float slope{ (Curve[j] - Curve[j - 1]) / (originalValue[j] - originalValue[j - 1]) };
+		float constant{ Curve[j] - slope * originalValue[j] };
+		lut[i] = slope * fullRange[i] + constant;
+	}
+}
+
+// 06_project/02_blemish_removal
+double getMean(const cv::Mat& gradImg)
+{
+	cv::Scalar m{ cv::mean(gradImg) };
+	return m.val[0];
+}
+
+// 06_project/02_blemish_removal
+double getSobelScore(const cv::Mat& curPatch)
+{
+	double score{ 0.0 };
+	cv::Mat grad_x, grad_y;
+	cv::Mat abs_grad_x, abs_grad_y;
+
+	cv::Sobel(curPatch, grad_x, CV_32F, 2, 0, 3, 1, 0);
+	cv::convertScaleAbs(grad_x, abs_grad_x);
+
+	cv::Sobel(curPatch, grad_y, CV_32F, 0, 2, 3, 1, 0);
+	cv::convertScaleAbs(grad_y, abs_grad_y);
+
+	cv::Mat grad;
+	cv::addWeighted(abs_grad_x, 0.5, abs_grad_y, 0.5, 0, grad);
+
+	score = getMean(grad);
+	return score;
+}
+
+// 04_image_enhancement_and_filtering/21_auto_focus_assignment
+double var_abs_laplacian(const cv::Mat& image)
+{
+	int kernelSize{ 3 };
+
+	cv::Mat gray;
+	cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+	cv::Mat blurred;
+	cv::GaussianBlur(gray, blurred, cv::Size(kernelSize, kernelSize), 0);
+
+	cv::Mat laplacian;
+	cv::Laplacian(blurred, laplacian, CV_32F, kernelSize, 1, 0);
+
+	cv::Mat laplacianABS;
+	laplacianABS = cv::abs(laplacian);
+
+	cv::Mat mean;
+	cv::Mat std;
+	cv::meanStdDev(laplacianABS, mean, std);
+
+	return std.at<double>(0, 0);
+}
+
+// 04_image_enhancement_and_filtering/21_auto_focus_assignment
+double sum_modified_laplacian(const cv::Mat& image)
+{
+	int kernelSize{ 3 };
+
+	cv::Mat gray;
+	cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+	cv::Mat blurred;
+	cv::GaussianBlur(gray, blurred, cv::Size(kernelSize, kernelSize), 0);
+
+	cv::Mat kernel1{ {3, 3}, {0, 0, 0, -1, 2, -1, 0, 0, 0} };
+	cv::Mat kernel2{ {3, 3}, {0, -1, 0, 0, 2, 0, 0, -1, 0} };
+
+	cv::Mat firstConv;
+	cv::filter2D(blurred, firstConv, CV_32F, kernel1);
+
+	cv::Mat secondConv;
+	cv::filter2D(blurred, secondConv, CV_32F, kernel2);
+
+	auto result = cv::sum(cv::abs(firstConv) + cv::abs(secondConv));
+
+	return result[0];
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Benchmark harness
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Named resolution of the sweep
+struct Resolution
+{
+	std::string name;
+	cv::Size size;
+};
+
+// Inputs shared by all kernels for one resolution, created once so allocation is not measured
+struct BenchmarkInput
+{
+	cv::Mat bgr;
+	cv::Mat gray;
+};
+
+// Single kernel registered in the benchmark. The run function gets prepared input and must do the full work of one call
+struct BenchmarkCase
+{
+	std::string name;
+	std::string lesson;
+	std::function<void(const BenchmarkInput&)> run;
+};
+
+// Statistics of one (kernel, resolution, threads) combination
+struct BenchmarkResult
+{
+	std::string kernel;
+	std::string lesson;
+	std::string resolution;
+	cv::Size size;
+	int threads{ 1 };
+	int repetitions{ 0 };
+	double minMs{ 0 };
+	double medianMs{ 0 };
+	double meanMs{ 0 };
+	double p99Ms{ 0 };
+	double maxMs{ 0 };
+	double megapixelsPerSecond{ 0 };
+};
+
+// Settings given from the command line
+struct BenchmarkSettings
+{
+	int warmup{ 2 };
+	int repetitions{ 10 };
+	std::vector<std::string> resolutions{ "VGA", "HD", "FHD", "4K", "8K" };
+	std::vector<int> threads;
+	std::string filter;
+	std::string outputPath{ "benchmark_results.json" };
+};
+
+/**
+ * \brief Split comma separated list into separate tokens.
+ * \param list Input string (eg. "1,2,4").
+ * \return Vector of non-empty tokens.
+ */
+std::vector<std::string> splitList(const std::string& list)
+{
+	std::vector<std::string> tokens;
+	std::stringstream ss{ list };
+	std::string token;
+
+	while (std::getline(ss, token, ','))
+	{
+		if (!token.empty())
+			tokens.push_back(token);
+	}
+
+	return tokens;
+}
+
+/**
+ * \brief Percentile using the nearest-rank method.
+ * \param sorted Samples sorted in ascending order (must not be empty).
+ * \param p Percentile in range (0, 100].
+ * \return Value of the given percentile.
+ */
+double percentile(const std::vector<double>& sorted, double p)
+{
+	auto rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+	rank = std::clamp<size_t>(rank, 1, sorted.size());
+	return sorted[rank - 1];
+}
+
+/**
+ * \brief Run one kernel with warm-up and repetitions and collect its statistics.
+ * \param benchmarkCase Kernel to measure.
+ * \param input Prepared input images.
+ * \param settings Number of warm-up iterations and repetitions.
+ * \return Timing statistics in milliseconds.
+ */
+BenchmarkResult measure(const BenchmarkCase& benchmarkCase, const BenchmarkInput& input, const BenchmarkSettings& settings)
+{
+	// Warm-up: touch the memory, fill the caches and let the thread pool spin up
+	for (int i{ 0 }; i < settings.warmup; ++i)
+		benchmarkCase.run(input);
+
+	std::vector<double> samples;
+	samples.reserve(settings.repetitions);
+
+	for (int i{ 0 }; i < settings.repetitions; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		benchmarkCase.run(input);
+		auto stop = std::chrono::steady_clock::now();
+
+		samples.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	BenchmarkResult result;
+	result.kernel = benchmarkCase.name;
+	result.lesson = benchmarkCase.lesson;
+	result.size = input.bgr.size();
+	result.threads = cv::getNumThreads();
+	result.repetitions = settings.repetitions;
+	result.minMs = samples.front();
+	result.maxMs = samples.back();
+	result.p99Ms = percentile(samples, 99);
+
+	// Median of even number of samples is a mean of two middle values
+	size_t mid{ samples.size() / 2 };
+	result.medianMs = samples.size() % 2 ? samples[mid] : 0.5 * (samples[mid - 1] + samples[mid]);
+
+	double total{ 0 };
+	for (double s : samples)
+		total += s;
+	result.meanMs = total / samples.size();
+
+	double megapixels{ result.size.area() / 1e6 };
+	result.megapixelsPerSecond = megapixels / (result.medianMs / 1000.0);
+
+	return result;
+}
+
+/**
+ * \brief Create all benchmark cases. Parameters are the same as used in the lessons.
+ * \return Vector of registered kernels.
+ */
+std::vector<BenchmarkCase> createBenchmarkCases()
+{
+	std::vector<BenchmarkCase> cases;
+
+	cases.push_back({ "thresholdingUsingForLoop", "03_binary_image_processing/01_thresholding",
+		[](const BenchmarkInput& in)
+		{
+			cv::Mat dst{ in.gray.size(), CV_8UC1 };
+			thresholdingUsingForLoop(in.gray, dst, 100, 255);
+		} });
+
+	cases.push_back({ "cv::threshold (reference)", "03_binary_image_processing/01_thresholding",
+		[](const BenchmarkInput& in)
+		{
+			cv::Mat dst;
+			cv::threshold(in.gray, dst, 100, 255, cv::THRESH_BINARY);
+		} });
+
+	cases.push_back({ "convertBGRtoGray", "04_image_enhancement_and_filtering/07_color_spaces_assignment",
+		[](const BenchmarkInput& in)
+		{
+			cv::Mat dst;
+			convertBGRtoGray(in.bgr, dst);
+		} });
+
+	cases.push_back({ "convertBGRtoHSV", "04_image_enhancement_and_filtering/07_color_spaces_assignment",
+		[](const BenchmarkInput& in)
+		{
+			cv::Mat dst;
+			convertBGRtoHSV(in.bgr, dst);
+		} });
+
+	cases.push_back({ "interp + cv::LUT", "04_image_enhancement_and_filtering/10_color_adjustment_using_curves",
+		[](const BenchmarkInput& in)
+		{
+			// Same warming curve as in the lesson
+			float originalValue[]{ 0, 50, 100, 150, 200, 255 };
+			float rCurve[]{ 0, 80, 150, 190, 220, 255 };
+			float bCurve[]{ 0, 20, 40, 75, 150, 255 };
+
+			float fullRange[256];
+			for (int i{ 0 }; i < 256; ++i)
+				fullRange[i] = static_cast<float>(i);
+
+			cv::Mat lookUpTable(1, 256, CV_8U);
+			uchar* lut = lookUpTable.ptr();
+
+			std::vector<cv::Mat> channels(3);
+			cv::split(in.bgr, channels);
+
+			interp(fullRange, bCurve, originalValue, lut);
+			cv::LUT(channels[0], lookUpTable, channels[0]);
+
+			interp(fullRange, rCurve, originalValue, lut);
+			cv::LUT(channels[2], lookUpTable, channels[2]);
+
+			cv::Mat output;
+			cv::merge(channels, output);
+		} });
+
+	cases.push_back({ "getSobelScore", "06_project/02_blemish_removal",
+		[](const BenchmarkInput& in)
+		{
+			getSobelScore(in.gray);
+		} });
+
+	cases.push_back({ "var_abs_laplacian", "04_image_enhancement_and_filtering/21_auto_focus_assignment",
+		[](const BenchmarkInput& in)
+		{
+			var_abs_laplacian(in.bgr);
+		} });
+
+	cases.push_back({ "sum_modified_laplacian", "04_image_enhancement_and_filtering/21_auto_focus_assignment",
+		[](const BenchmarkInput& in)
+		{
+			sum_modified_laplacian(in.bgr);
+		} });
+
+	return cases;
+}
+
+/**
+ * \brief Escape string to be a valid JSON string literal content.
+ * \param s Input string.
+ * \return Escaped string.
+ */
+std::string jsonEscape(const std::string& s)
+{
+	std::string out;
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '"':  out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\t': out += "\\t"; break;
+		default:   out += c; break;
+		}
+	}
+	return out;
+}
+
+/**
+ * \brief Write all results together with information about the machine as JSON.
+ * \param path Path of the output file.
+ * \param settings Settings used for the run.
+ * \param results Collected results.
+ * \return True if the file was written.
+ */
+bool writeJson(const std::string& path, const BenchmarkSettings& settings, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream out{ path };
+	if (!out)
+		return false;
+
+	std::time_t now{ std::time(nullptr) };
+	char timestamp[32];
+	std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+	out << std::fixed << std::setprecision(4);
+	out << "{\n";
+	out << "  \"timestamp\": \"" << timestamp << "\",\n";
+	out << "  \"opencv_version\": \"" << CV_VERSION << "\",\n";
+	out << "  \"cpus\": " << cv::getNumberOfCPUs() << ",\n";
+	out << "  \"simd\": { \"sse4_1\": " << std::boolalpha << cv::checkHardwareSupport(CV_CPU_SSE4_1)
+		<< ", \"avx2\": " << cv::checkHardwareSupport(CV_CPU_AVX2)
+		<< ", \"avx512bw\": " << cv::checkHardwareSupport(CV_CPU_AVX_512BW) << " },\n";
+	out << "  \"warmup\": " << settings.warmup << ",\n";
+	out << "  \"repetitions\": " << settings.repetitions << ",\n";
+	out << "  \"results\": [\n";
+
+	for (size_t i{ 0 }; i < results.size(); ++i)
+	{
+		const auto& r = results[i];
+		out << "    { \"kernel\": \"" << jsonEscape(r.kernel) << "\""
+			<< ", \"lesson\": \"" << jsonEscape(r.lesson) << "\""
+			<< ", \"resolution\": \"" << r.resolution << "\""
+			<< ", \"width\": " << r.size.width
+			<< ", \"height\": " << r.size.height
+			<< ", \"threads\": " << r.threads
+			<< ", \"repetitions\": " << r.repetitions
+			<< ", \"min_ms\": " << r.minMs
+			<< ", \"median_ms\": " << r.medianMs
+			<< ", \"mean_ms\": " << r.meanMs
+			<< ", \"p99_ms\": " << r.p99Ms
+			<< ", \"max_ms\": " << r.maxMs
+			<< ", \"mpix_per_s\": " << r.megapixelsPerSecond
+			<< " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	out << "  ]\n";
+	out << "}\n";
+
+	return static_cast<bool>(out);
+}
+
+/**
+ * \brief Parse command line arguments.
+ * \param argc Number of arguments.
+ * \param argv Arguments.
+ * \param settings Output settings.
+ * \return False if arguments are wrong (usage should be printed).
+ */
+bool parseArguments(int argc, char** argv, BenchmarkSettings& settings)
+{
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+
+		// Every option expects a value
+		if (i + 1 >= argc)
+			return false;
+		std::string value{ argv[++i] };
+
+		if (arg == "--reps")
+			settings.repetitions = std::max(1, std::stoi(value));
+		else if (arg == "--warmup")
+			settings.warmup = std::max(0, std::stoi(value));
+		else if (arg == "--resolutions")
+			settings.resolutions = splitList(value);
+		else if (arg == "--threads")
+		{
+			settings.threads.clear();
+			for (const auto& t : splitList(value))
+				settings.threads.push_back(std::max(1, std::stoi(t)));
+		}
+		else if (arg == "--filter")
+			settings.filter = value;
+		else if (arg == "--out")
+			settings.outputPath = value;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	BenchmarkSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		std::cout << "Usage: " << argv[0] << " [--reps N] [--warmup N] [--resolutions VGA,HD,FHD,4K,8K]"
+			<< " [--threads 1,2,4] [--filter name] [--out file.json]" << std::endl;
+		return -1;
+	}
+
+	// By default sweep powers of two up to the number of logical CPUs (and the CPU count itself)
+	if (settings.threads.empty())
+	{
+		int cpus{ cv::getNumberOfCPUs() };
+		for (int t{ 1 }; t < cpus; t *= 2)
+			settings.threads.push_back(t);
+		settings.threads.push_back(cpus);
+	}
+
+	const std::vector<Resolution> allResolutions
+	{
+		{ "VGA", { 640, 480 } },
+		{ "HD", { 1280, 720 } },
+		{ "FHD", { 1920, 1080 } },
+		{ "4K", { 3840, 2160 } },
+		{ "8K", { 7680, 4320 } },
+	};
+
+	std::vector<BenchmarkCase> cases{ createBenchmarkCases() };
+	std::vector<BenchmarkResult> results;
+
+	std::cout << std::left << std::setw(28) << "kernel" << std::setw(6) << "res" << std::setw(9) << "threads"
+		<< std::right << std::setw(12) << "median[ms]" << std::setw(12) << "p99[ms]" << std::setw(12) << "MPix/s" << std::endl;
+
+	for (const auto& resolution : allResolutions)
+	{
+		if (std::find(settings.resolutions.begin(), settings.resolutions.end(), resolution.name) == settings.resolutions.end())
+			continue;
+
+		// Random content, fixed seed, so all runs see exactly the same data
+		BenchmarkInput input;
+		input.bgr.create(resolution.size, CV_8UC3);
+		cv::setRNGSeed(42);
+		cv::randu(input.bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::cvtColor(input.bgr, input.gray, cv::COLOR_BGR2GRAY);
+
+		for (int threads : settings.threads)
+		{
+			cv::setNumThreads(threads);
+
+			for (const auto& benchmarkCase : cases)
+			{
+				if (!settings.filter.empty() and benchmarkCase.name.find(settings.filter) == std::string::npos)
+					continue;
+
+				BenchmarkResult result{ measure(benchmarkCase, input, settings) };
+				result.resolution = resolution.name;
+				results.push_back(result);
+
+				std::cout << std::left << std::setw(28) << result.kernel << std::setw(6) << result.resolution
+					<< std::setw(9) << result.threads << std::right << std::fixed << std::setprecision(3)
+					<< std::setw(12) << result.medianMs << std::setw(12) << result.p99Ms
+					<< std::setw(12) << std::setprecision(1) << result.megapixelsPerSecond << std::endl;
+			}
+		}
+	}
+
+	// Restore default number of threads
+	cv::setNumThreads(-1);
+
+	if (!writeJson(settings.outputPath, settings, results))
+	{
+		std::cout << "Can't write results to " << settings.outputPath << std::endl;
+		return -1;
+	}
+
+	std::cout << "Results saved to " << settings.outputPath << std::endl;
+
+	return 0;
+}
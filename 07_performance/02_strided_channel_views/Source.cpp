@@ -0,0 +1,360 @@
+/*
+ * Strided channel views
+ * Many lessons work on a single channel of a color image, eg. equalize the V channel of HSV (08_histogram_equalization),
+ * scale the saturation (06_desaturation), read the alpha channel (09_images_with_alpha_channel) or apply a curve to one
+ * color (10_color_adjustment_using_curves). They all follow the same pattern:
+ *	cv::split(img, channels);
+ *	process(channels[i]);
+ *	cv::merge(channels, img);
+ * cv::split copies the whole image into separate planes and cv::merge copies it back, so the image is written twice
+ * just to change one third of it.
+ *
+ * A cv::Mat can not describe "every third byte", but a channel of an interleaved image is just that: the pixel at (x, y)
+ * of channel c is at data + y * step + x * channels + c. ChannelView keeps this pointer arithmetic and lets the
+ * operations read and write the channel in place:
+ *	- applyLUT - any 8-bit point operation (curves, gamma, ...),
+ *	- calcHistogram - histogram of the channel,
+ *	- equalizeHist - the same result as cv::equalizeHist,
+ *	- scaleAdd - saturate(alpha * v + beta), covers multiplication and addition (saturation scaling, brightness),
+ *	- threshold - the same result as cv::threshold for 8-bit images.
+ * All point operations on 8-bit data are table lookups, so they share one kernel.
+ *
+ * The program compares every operation with the split/merge version on a 4K frame and prints both times.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * One channel of an interleaved 8-bit image, without copying it.
+ * The view does not own the data, the image must outlive it. It works with ROIs (step is taken from the cv::Mat).
+ */
+class ChannelView
+{
+public:
+	/**
+	 * \brief Create a view of one channel.
+	 * \param img Image with depth CV_8U.
+	 * \param channel Index of the channel.
+	 */
+	ChannelView(cv::Mat& img, int channel)
+		: data_(img.data + channel), step_(img.step[0]), pixelStride_(img.channels()), size_(img.size())
+	{
+		CV_Assert(img.depth() == CV_8U and channel >= 0 and channel < img.channels());
+	}
+
+	uchar* row(int y) const { return data_ + y * step_; }
+	int pixelStride() const { return pixelStride_; }
+	cv::Size size() const { return size_; }
+	int rows() const { return size_.height; }
+	int cols() const { return size_.width; }
+	size_t total() const { return static_cast<size_t>(size_.width) * size_.height; }
+
+	uchar& at(int y, int x) const { return row(y)[x * pixelStride_]; }
+
+private:
+	uchar* data_;
+	size_t step_;
+	int pixelStride_;
+	cv::Size size_;
+};
+
+/**
+ * \brief Number of stripes for cv::parallel_for_, about 64 kB of image data per stripe.
+ */
+double stripesFor(const ChannelView& view)
+{
+	return std::max(1.0, view.rows() * static_cast<double>(view.cols()) * view.pixelStride() / 65536.0);
+}
+
+/**
+ * \brief Replace every value of the channel with lut[value], in place.
+ * \param view Channel.
+ * \param lut Table with 256 values.
+ */
+void applyLUT(const ChannelView& view, const std::array<uchar, 256>& lut)
+{
+	cv::parallel_for_(cv::Range(0, view.rows()), [&](const cv::Range& range)
+	{
+		const int stride{ view.pixelStride() };
+		const int length{ view.cols() * stride };
+
+		for (int y{ range.start }; y < range.end; ++y)
+		{
+			uchar* p{ view.row(y) };
+			for (int i{ 0 }; i < length; i += stride)
+				p[i] = lut[p[i]];
+		}
+	}, stripesFor(view));
+}
+
+/**
+ * \brief Histogram of the channel.
+ * \param view Channel.
+ * \return Number of occurrences of every value.
+ */
+std::array<int, 256> calcHistogram(const ChannelView& view)
+{
+	std::array<int, 256> hist{};
+	std::mutex mutex;
+
+	cv::parallel_for_(cv::Range(0, view.rows()), [&](const cv::Range& range)
+	{
+		const int stride{ view.pixelStride() };
+		const int length{ view.cols() * stride };
+		std::array<int, 256> local{};
+
+		for (int y{ range.start }; y < range.end; ++y)
+		{
+			const uchar* p{ view.row(y) };
+			for (int i{ 0 }; i < length; i += stride)
+				++local[p[i]];
+		}
+
+		std::lock_guard<std::mutex> lock{ mutex };
+		for (int i{ 0 }; i < 256; ++i)
+			hist[i] += local[i];
+	}, stripesFor(view));
+
+	return hist;
+}
+
+/**
+ * \brief Histogram equalization of the channel in place, the same mapping as cv::equalizeHist.
+ * \param view Channel.
+ */
+void equalizeHist(const ChannelView& view)
+{
+	std::array<int, 256> hist{ calcHistogram(view) };
+	std::array<uchar, 256> lut{};
+
+	// The first used value is mapped to 0 and the rest is spread over [0, 255] by the cumulative histogram
+	int first{ 0 };
+	while (first < 255 and hist[first] == 0)
+		++first;
+
+	const int total{ static_cast<int>(view.total()) };
+	if (hist[first] == total)
+	{
+		lut.fill(static_cast<uchar>(first));
+	}
+	else
+	{
+		const float scale{ 255.f / (total - hist[first]) };
+		int sum{ 0 };
+		for (int i{ first + 1 }; i < 256; ++i)
+		{
+			sum += hist[i];
+			lut[i] = cv::saturate_cast<uchar>(sum * scale);
+		}
+	}
+
+	applyLUT(view, lut);
+}
+
+/**
+ * \brief view = saturate(alpha * view + beta), in place.
+ * \param view Channel.
+ * \param alpha Scale factor.
+ * \param beta Offset.
+ */
+void scaleAdd(const ChannelView& view, double alpha, double beta = 0)
+{
+	std::array<uchar, 256> lut;
+	for (int i{ 0 }; i < 256; ++i)
+		lut[i] = cv::saturate_cast<uchar>(alpha * i + beta);
+
+	applyLUT(view, lut);
+}
+
+/**
+ * \brief Threshold the channel in place, the same result as cv::threshold on an 8-bit image.
+ * \param view Channel.
+ * \param thresh Threshold value.
+ * \param maxValue Value used by THRESH_BINARY and THRESH_BINARY_INV.
+ * \param type cv::THRESH_BINARY, THRESH_BINARY_INV, THRESH_TRUNC, THRESH_TOZERO or THRESH_TOZERO_INV.
+ */
+void threshold(const ChannelView& view, double thresh, double maxValue, int type)
+{
+	// cv::threshold on 8-bit data compares with the integer part of the threshold
+	const int t{ cvFloor(thresh) };
+	const uchar m{ cv::saturate_cast<uchar>(maxValue) };
+
+	std::array<uchar, 256> lut;
+	for (int i{ 0 }; i < 256; ++i)
+	{
+		const bool above{ i > t };
+		switch (type)
+		{
+		case cv::THRESH_BINARY: lut[i] = above ? m : 0; break;
+		case cv::THRESH_BINARY_INV: lut[i] = above ? 0 : m; break;
+		case cv::THRESH_TRUNC: lut[i] = static_cast<uchar>(above ? std::clamp(t, 0, 255) : i); break;
+		case cv::THRESH_TOZERO: lut[i] = above ? static_cast<uchar>(i) : 0; break;
+		case cv::THRESH_TOZERO_INV: lut[i] = above ? 0 : static_cast<uchar>(i); break;
+		default: CV_Error(cv::Error::StsBadArg, "Unsupported threshold type");
+		}
+	}
+
+	applyLUT(view, lut);
+}
+
+/**
+ * \brief Median time of a function in milliseconds.
+ * \param func Function to measure. It gets a fresh copy of the input every time.
+ * \param input Input image.
+ * \param repetitions Number of measured calls.
+ * \return Median time in milliseconds.
+ */
+double medianMs(const std::function<void(cv::Mat&)>& func, const cv::Mat& input, int repetitions = 15)
+{
+	std::vector<double> times;
+	cv::Mat work;
+
+	for (int i{ 0 }; i < repetitions; ++i)
+	{
+		input.copyTo(work);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		func(work);
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+/**
+ * \brief Run the split/merge version and the channel view version, compare results and print times.
+ * \param name Name of the operation.
+ * \param input Input image.
+ * \param splitMerge Reference implementation.
+ * \param view Channel view implementation.
+ */
+void compare(const std::string& name, const cv::Mat& input, const std::function<void(cv::Mat&)>& splitMerge, const std::function<void(cv::Mat&)>& view)
+{
+	cv::Mat reference{ input.clone() }, result{ input.clone() };
+	splitMerge(reference);
+	view(result);
+
+	std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(12) << medianMs(splitMerge, input) << std::setw(12) << medianMs(view, input)
+		<< std::setw(12) << cv::norm(reference, result, cv::NORM_INF) << std::endl;
+}
+
+
+int main()
+{
+	// Random content, fixed seed, smoothed a bit so histograms are not flat
+	cv::Mat bgr(cv::Size(3840, 2160), CV_8UC3);
+	cv::setRNGSeed(42);
+	cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::GaussianBlur(bgr, bgr, cv::Size(5, 5), 0);
+
+	cv::Mat hsv;
+	cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+
+	cv::Mat bgra;
+	cv::cvtColor(bgr, bgra, cv::COLOR_BGR2BGRA);
+
+	std::cout << std::left << std::setw(24) << "operation" << std::right << std::setw(12) << "split[ms]"
+		<< std::setw(12) << "view[ms]" << std::setw(12) << "max diff" << std::endl;
+
+	// 08_histogram_equalization: equalize V of HSV
+	compare("equalize V", hsv,
+		[](cv::Mat& img)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			cv::equalizeHist(channels[2], channels[2]);
+			cv::merge(channels, img);
+		},
+		[](cv::Mat& img) { equalizeHist(ChannelView(img, 2)); });
+
+	// 06_desaturation: scale S of HSV
+	const double saturationScale{ 0.01 };
+	compare("scale S", hsv,
+		[saturationScale](cv::Mat& img)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			channels[1].convertTo(channels[1], CV_32F);
+			channels[1] *= saturationScale;
+			channels[1].convertTo(channels[1], CV_8U);
+			cv::merge(channels, img);
+		},
+		[saturationScale](cv::Mat& img) { scaleAdd(ChannelView(img, 1), saturationScale); });
+
+	// Brightness of one color channel
+	compare("add to R", bgr,
+		[](cv::Mat& img)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			cv::add(channels[2], 40, channels[2]);
+			cv::merge(channels, img);
+		},
+		[](cv::Mat& img) { scaleAdd(ChannelView(img, 2), 1, 40); });
+
+	// 10_color_adjustment_using_curves: a curve applied to one channel
+	std::array<uchar, 256> curve;
+	cv::Mat curveMat(1, 256, CV_8U);
+	for (int i{ 0 }; i < 256; ++i)
+		curve[i] = curveMat.at<uchar>(i) = cv::saturate_cast<uchar>(255.0 * std::pow(i / 255.0, 0.7));
+
+	compare("curve on B", bgr,
+		[&curveMat](cv::Mat& img)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			cv::LUT(channels[0], curveMat, channels[0]);
+			cv::merge(channels, img);
+		},
+		[&curve](cv::Mat& img) { applyLUT(ChannelView(img, 0), curve); });
+
+	// 09_images_with_alpha_channel: binarize the alpha channel
+	compare("threshold alpha", bgra,
+		[](cv::Mat& img)
+		{
+			std::vector<cv::Mat> channels;
+			cv::split(img, channels);
+			cv::threshold(channels[3], channels[3], 127, 255, cv::THRESH_BINARY);
+			cv::merge(channels, img);
+		},
+		[](cv::Mat& img) { threshold(ChannelView(img, 3), 127, 255, cv::THRESH_BINARY); });
+
+	// Histogram of one channel
+	{
+		std::vector<cv::Mat> channels;
+		cv::split(hsv, channels);
+
+		cv::Mat reference;
+		int histSize{ 256 };
+		float range[]{ 0, 256 };
+		const float* ranges{ range };
+		cv::calcHist(&channels[2], 1, nullptr, cv::Mat(), reference, 1, &histSize, &ranges);
+
+		std::array<int, 256> hist{ calcHistogram(ChannelView(hsv, 2)) };
+
+		int differences{ 0 };
+		for (int i{ 0 }; i < 256; ++i)
+			differences += hist[i] != cvRound(reference.at<float>(i));
+
+		std::cout << "Histogram of V, bins different from cv::calcHist: " << differences << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * Typed images
+ * cv::Mat does not know the type of its elements at compile time. The lessons either ask for it at runtime (type2str in
+ * 01_getting_started/01_image_as_matrix decodes Mat::type()) or access pixels with img.at<T>(y, x). at<T>() checks the
+ * type and the bounds on every access in debug builds, and even in release builds it computes the address from the row
+ * step for every pixel, which hides from the compiler that a row is one contiguous array. Such loops are not
+ * vectorized.
+ *
+ * TypedImage<T, Channels> is a thin view over a cv::Mat with the element type and the number of channels fixed at
+ * compile time:
+ *	- the type is checked once, when the view is created,
+ *	- rows are plain pointers (row(y)) and channels are compile time indices (channel<C>(y, x)),
+ *	- the type name is known at compile time (TypedImage::typeName()), no runtime decoding is needed,
+ *	- parallel_for_each() runs a per pixel function over whole rows (or over the whole image at once if it is
+ *	  continuous), split between threads with cv::parallel_for_. The pixel function gets pointers to the pixel
+ *	  channels, the loop has a compile time stride, so the compiler can inline and vectorize it.
+ *
+ * The program implements the thresholding loop (03_binary_image_processing/01_thresholding), the BGR to gray loop
+ * (04_image_enhancement_and_filtering/07_color_spaces_assignment) and the QR bounding box extraction
+ * (01_getting_started/27_exercise_build_a_qr) three times: with at<T>(), with hand-written pointer code and with
+ * TypedImage, and compares their results and times. The at<T>() and pointer loops run on one thread, so TypedImage is
+ * timed twice: on one thread (cv::setNumThreads(1)), which compares only the loops, and with all threads, which shows
+ * what parallel_for_each() adds on top.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+/**
+ * View of a cv::Mat with element type T and Channels channels known at compile time.
+ * The view shares the data with the cv::Mat (like a cv::Mat header), it does not copy anything.
+ */
+template<typename T, int Channels>
+class TypedImage
+{
+public:
+	static_assert(Channels >= 1 and Channels <= 4, "Only 1 to 4 channels are supported");
+
+	using value_type = T;
+	static constexpr int channels{ Channels };
+	static constexpr int depth{ cv::traits::Depth<T>::value };
+	static constexpr int type{ CV_MAKETYPE(depth, Channels) };
+
+	static_assert(depth >= 0 and depth < 8, "Unknown element type");
+
+	/**
+	 * \brief Wrap an existing image, its type must match.
+	 * \param img Image.
+	 */
+	explicit TypedImage(const cv::Mat& img)
+		: mat_(img)
+	{
+		CV_Assert(img.type() == type and img.dims == 2);
+	}
+
+	/**
+	 * \brief Allocate a new image.
+	 * \param size Size of the image.
+	 */
+	explicit TypedImage(cv::Size size)
+		: mat_(size, type)
+	{}
+
+	/**
+	 * \brief Name of the type in the same format as type2str(), eg. "8UC3", known at compile time.
+	 */
+	static constexpr const char* typeName()
+	{
+		return typeNames[depth][Channels - 1];
+	}
+
+	T* row(int y) { return mat_.template ptr<T>(y); }
+	const T* row(int y) const { return mat_.template ptr<T>(y); }
+
+	// Channels of pixel (y, x), no checks
+	T* pixel(int y, int x) { return row(y) + x * Channels; }
+	const T* pixel(int y, int x) const { return row(y) + x * Channels; }
+
+	// Channel with compile time index
+	template<int C>
+	T& channel(int y, int x)
+	{
+		static_assert(C >= 0 and C < Channels, "Channel index out of range");
+		return pixel(y, x)[C];
+	}
+
+	template<int C>
+	const T& channel(int y, int x) const
+	{
+		static_assert(C >= 0 and C < Channels, "Channel index out of range");
+		return pixel(y, x)[C];
+	}
+
+	int rows() const { return mat_.rows; }
+	int cols() const { return mat_.cols; }
+	cv::Size size() const { return mat_.size(); }
+	bool isContinuous() const { return mat_.isContinuous(); }
+
+	const cv::Mat& mat() const { return mat_; }
+
+private:
+	// Rows are depths, columns are channels (1 to 4)
+	static constexpr const char* typeNames[8][4]
+	{
+		{ "8UC1", "8UC2", "8UC3", "8UC4" },
+		{ "8SC1", "8SC2", "8SC3", "8SC4" },
+		{ "16UC1", "16UC2", "16UC3", "16UC4" },
+		{ "16SC1", "16SC2", "16SC3", "16SC4" },
+		{ "32SC1", "32SC2", "32SC3", "32SC4" },
+		{ "32FC1", "32FC2", "32FC3", "32FC4" },
+		{ "64FC1", "64FC2", "64FC3", "64FC4" },
+		{ "16FC1", "16FC2", "16FC3", "16FC4" },
+	};
+
+	cv::Mat mat_;
+};
+
+/**
+ * \brief Call func(srcPixel, dstPixel) for every pixel, in parallel. Both arguments are pointers to the channels of the
+ * pixel. If both images are continuous, all rows of a stripe are processed as one long row, so the inner loop is as
+ * long as possible.
+ * \param src Source image.
+ * \param dst Destination image of the same size.
+ * \param func Pixel function.
+ */
+template<typename SrcT, int SrcCn, typename DstT, int DstCn, typename Func>
+void parallel_for_each(const TypedImage<SrcT, SrcCn>& src, TypedImage<DstT, DstCn>& dst, Func func)
+{
+	CV_Assert(src.size() == dst.size());
+
+	const bool continuous{ src.isContinuous() and dst.isContinuous() };
+	const int cols{ src.cols() };
+
+	auto body = [&](const cv::Range& range)
+	{
+		// The rows of a stripe follow each other in memory, one loop goes over all of them
+		if (continuous)
+		{
+			const SrcT* s{ src.row(range.start) };
+			DstT* d{ dst.row(range.start) };
+			const int n{ (range.end - range.start) * cols };
+
+			for (int i{ 0 }; i < n; ++i)
+				func(s + i * SrcCn, d + i * DstCn);
+		}
+		else
+		{
+			for (int y{ range.start }; y < range.end; ++y)
+			{
+				const SrcT* s{ src.row(y) };
+				DstT* d{ dst.row(y) };
+
+				for (int i{ 0 }; i < cols; ++i)
+					func(s + i * SrcCn, d + i * DstCn);
+			}
+		}
+	};
+
+	const double bytes{ static_cast<double>(src.rows()) * src.cols() * SrcCn * sizeof(SrcT) };
+	cv::parallel_for_(cv::Range(0, src.rows()), body, std::max(1.0, bytes / 65536.0));
+}
+
+/**
+ * \brief In place version, func(pixel) is called for every pixel.
+ * \param img Image.
+ * \param func Pixel function.
+ */
+template<typename T, int Cn, typename Func>
+void parallel_for_each(TypedImage<T, Cn>& img, Func func)
+{
+	parallel_for_each(img, img, [&func](const T*, T* pixel) { func(pixel); });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Thresholding
+
+void thresholdAt(const cv::Mat& src, cv::Mat& dst, int thresh, int maxValue)
+{
+	for (int i{ 0 }; i < src.rows; ++i)
+		for (int j{ 0 }; j < src.cols; ++j)
+			dst.at<uchar>(i, j) = src.at<uchar>(i, j) > thresh ? maxValue : 0;
+}
+
+void thresholdPointer(const cv::Mat& src, cv::Mat& dst, int thresh, int maxValue)
+{
+	for (int i{ 0 }; i < src.rows; ++i)
+	{
+		const uchar* s{ src.ptr<uchar>(i) };
+		uchar* d{ dst.ptr<uchar>(i) };
+		for (int j{ 0 }; j < src.cols; ++j)
+			d[j] = s[j] > thresh ? maxValue : 0;
+	}
+}
+
+void thresholdTyped(const TypedImage<uchar, 1>& src, TypedImage<uchar, 1>& dst, int thresh, int maxValue)
+{
+	const uchar m{ cv::saturate_cast<uchar>(maxValue) };
+
+	parallel_for_each(src, dst, [thresh, m](const uchar* s, uchar* d) { d[0] = s[0] > thresh ? m : 0; });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// BGR to gray, Y = 0.299 R + 0.587 G + 0.114 B
+
+void grayAt(const cv::Mat& src, cv::Mat& dst)
+{
+	for (int h{ 0 }; h < src.rows; ++h)
+	{
+		for (int w{ 0 }; w < src.cols; ++w)
+		{
+			const cv::Vec3b& p{ src.at<cv::Vec3b>(h, w) };
+			dst.at<uchar>(h, w) = cv::saturate_cast<uchar>(0.114f * p[0] + 0.587f * p[1] + 0.299f * p[2]);
+		}
+	}
+}
+
+void grayPointer(const cv::Mat& src, cv::Mat& dst)
+{
+	for (int h{ 0 }; h < src.rows; ++h)
+	{
+		const uchar* s{ src.ptr<uchar>(h) };
+		uchar* d{ dst.ptr<uchar>(h) };
+		for (int w{ 0 }; w < src.cols; ++w)
+			d[w] = cv::saturate_cast<uchar>(0.114f * s[3 * w] + 0.587f * s[3 * w + 1] + 0.299f * s[3 * w + 2]);
+	}
+}
+
+void grayTyped(const TypedImage<uchar, 3>& src, TypedImage<uchar, 1>& dst)
+{
+	parallel_for_each(src, dst, [](const uchar* bgr, uchar* gray)
+	{
+		gray[0] = cv::saturate_cast<uchar>(0.114f * bgr[0] + 0.587f * bgr[1] + 0.299f * bgr[2]);
+	});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// QR bounding box: 4 corners stored as a 1x4 CV_32FC2 matrix
+
+std::vector<cv::Point> boxAt(const cv::Mat& bbox)
+{
+	std::vector<cv::Point> points;
+	for (int i{ 0 }; i < 4; ++i)
+		points.emplace_back(static_cast<int>(bbox.at<float>(0, 2 * i)), static_cast<int>(bbox.at<float>(0, 2 * i + 1)));
+	return points;
+}
+
+std::vector<cv::Point> boxTyped(const TypedImage<float, 2>& bbox)
+{
+	std::vector<cv::Point> points;
+	for (int i{ 0 }; i < bbox.cols(); ++i)
+		points.emplace_back(static_cast<int>(bbox.channel<0>(0, i)), static_cast<int>(bbox.channel<1>(0, i)));
+	return points;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * \brief Median time of a function in milliseconds.
+ * \param func Function to measure.
+ * \param repetitions Number of measured calls.
+ * \return Median time in milliseconds.
+ */
+template<typename Func>
+double medianMs(Func&& func, int repetitions = 11)
+{
+	std::vector<double> times;
+	for (int i{ 0 }; i < repetitions; ++i)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		func();
+		auto stop = std::chrono::high_resolution_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+void printRow(const std::string& name, double atMs, double pointerMs, double typedSerialMs, double typedMs, double difference)
+{
+	std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(10) << atMs << std::setw(14) << pointerMs << std::setw(16) << typedSerialMs << std::setw(16) << typedMs
+		<< std::setw(12) << difference << std::endl;
+}
+
+
+int main()
+{
+	// The type name is a compile time constant
+	static_assert(TypedImage<uchar, 3>::type == CV_8UC3);
+	std::cout << "TypedImage<uchar, 3>: " << TypedImage<uchar, 3>::typeName()
+		<< ", TypedImage<float, 2>: " << TypedImage<float, 2>::typeName() << std::endl;
+
+	// Random content, fixed seed
+	cv::Mat bgr(cv::Size(3840, 2160), CV_8UC3);
+	cv::setRNGSeed(42);
+	cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	cv::Mat gray;
+	cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+
+	std::cout << std::left << std::setw(12) << "kernel" << std::right << std::setw(10) << "at[ms]"
+		<< std::setw(14) << "pointer[ms]" << std::setw(16) << "typed 1T[ms]" << std::setw(16) << "typed MT[ms]"
+		<< std::setw(12) << "max diff" << std::endl;
+
+	// Thresholding
+	{
+		cv::Mat a(gray.size(), CV_8U), p(gray.size(), CV_8U);
+		TypedImage<uchar, 1> src(gray), t(gray.size());
+
+		double atMs{ medianMs([&] { thresholdAt(gray, a, 127, 255); }) };
+		double pointerMs{ medianMs([&] { thresholdPointer(gray, p, 127, 255); }) };
+
+		cv::setNumThreads(1);
+		double typedSerialMs{ medianMs([&] { thresholdTyped(src, t, 127, 255); }) };
+		cv::setNumThreads(-1);
+		double typedMs{ medianMs([&] { thresholdTyped(src, t, 127, 255); }) };
+
+		printRow("threshold", atMs, pointerMs, typedSerialMs, typedMs, std::max(cv::norm(a, p, cv::NORM_INF), cv::norm(a, t.mat(), cv::NORM_INF)));
+	}
+
+	// BGR to gray
+	{
+		cv::Mat a(bgr.size(), CV_8U), p(bgr.size(), CV_8U);
+		TypedImage<uchar, 3> src(bgr);
+		TypedImage<uchar, 1> t(bgr.size());
+
+		double atMs{ medianMs([&] { grayAt(bgr, a); }) };
+		double pointerMs{ medianMs([&] { grayPointer(bgr, p); }) };
+
+		cv::setNumThreads(1);
+		double typedSerialMs{ medianMs([&] { grayTyped(src, t); }) };
+		cv::setNumThreads(-1);
+		double typedMs{ medianMs([&] { grayTyped(src, t); }) };
+
+		printRow("gray", atMs, pointerMs, typedSerialMs, typedMs, std::max(cv::norm(a, p, cv::NORM_INF), cv::norm(a, t.mat(), cv::NORM_INF)));
+	}
+
+	// QR bounding box
+	{
+		cv::Mat bbox(1, 4, CV_32FC2);
+		const float corners[]{ 10.5f, 20.25f, 110.f, 20.75f, 110.5f, 120.f, 10.f, 119.5f };
+		std::copy(std::begin(corners), std::end(corners), bbox.ptr<float>(0));
+
+		std::vector<cv::Point> a{ boxAt(bbox) };
+		std::vector<cv::Point> t{ boxTyped(TypedImage<float, 2>(bbox)) };
+
+		std::cout << "QR box corners equal: " << std::boolalpha << (a == t) << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,662 @@
+/*
+ * Batched rasterizer
+ * The drawing lessons (22_drawing_lines ... 25_drawing_rectangles) and the contour lessons draw every primitive with its
+ * own call of cv::line, cv::circle, cv::ellipse or cv::rectangle. That is fine for a few shapes, but an inspection
+ * overlay with thousands of primitives per frame spends more time drawing than detecting: every call walks its own
+ * pixels one by one on a single thread, and with cv::LINE_AA every pixel is blended separately.
+ *
+ * BatchRenderer collects the primitives first and draws them all at once:
+ *	1. Every primitive is converted to one or more simple shapes with an analytic distance function: a capsule (line
+ *	   segment with thickness), an axis aligned box, or an ellipse (filled or outline, circles are ellipses too).
+ *	   Anti-aliasing comes directly from the distance: a pixel whose center is half a pixel outside the edge gets
+ *	   zero coverage, half a pixel inside gets full coverage.
+ *	2. The image is divided into 64x64 tiles and every shape is put into the lists of the tiles it touches (binning).
+ *	3. Tiles are rasterized in parallel with cv::parallel_for_. A tile is always drawn by one thread, in the order the
+ *	   primitives were added, so the result does not depend on the number of threads. Coverage of a span is computed
+ *	   4 pixels at a time with float SIMD and the color is blended into 16 pixels at a time.
+ *
+ * Coordinates follow OpenCV, the center of pixel (x, y) is at (x, y).
+ *
+ * The program draws the same random primitives with cv:: functions (cv::LINE_AA) and with BatchRenderer and prints both
+ * times.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+
+/**
+ * \brief Exact division by 255 with rounding for x in [0, 255 * 255].
+ */
+inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 div255(const cv::v_uint16x8& x)
+{
+	cv::v_uint16x8 t{ cv::v_add_wrap(x, cv::v_setall_u16(128)) };
+	return cv::v_shr<8>(cv::v_add_wrap(t, cv::v_shr<8>(t)));
+}
+#endif
+
+/**
+ * \brief Blend a single color into a row of BGR pixels with per pixel alpha.
+ * \param dst Pointer to the first BGR pixel.
+ * \param alpha Coverage of every pixel, 0 - 255.
+ * \param width Number of pixels.
+ * \param color BGR color.
+ */
+void blendSpan(uchar* dst, const uchar* alpha, int width, const uchar (&color)[3])
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint8x16 zero{ cv::v_setzero_u8() };
+	const cv::v_uint8x16 maxAlpha{ cv::v_setall_u8(255) };
+	const cv::v_uint8x16 colors[3]{ cv::v_setall_u8(color[0]), cv::v_setall_u8(color[1]), cv::v_setall_u8(color[2]) };
+
+	for (; x <= width - 16; x += 16)
+	{
+		cv::v_uint8x16 a{ cv::v_load(alpha + x) };
+
+		// Nothing covered
+		if (!cv::v_check_any(a != zero))
+			continue;
+
+		cv::v_uint8x16 d[3];
+		cv::v_load_deinterleave(dst + 3 * x, d[0], d[1], d[2]);
+
+		cv::v_uint8x16 inverse{ maxAlpha - a };
+		for (int c{ 0 }; c < 3; ++c)
+		{
+			cv::v_uint16x8 low0, high0, low1, high1;
+			cv::v_mul_expand(d[c], inverse, low0, high0);
+			cv::v_mul_expand(colors[c], a, low1, high1);
+			d[c] = cv::v_pack(div255(cv::v_add_wrap(low0, low1)), div255(cv::v_add_wrap(high0, high1)));
+		}
+
+		cv::v_store_interleave(dst + 3 * x, d[0], d[1], d[2]);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		const int a{ alpha[x] };
+		if (a == 0)
+			continue;
+
+		uchar* d{ dst + 3 * x };
+		for (int c{ 0 }; c < 3; ++c)
+			d[c] = static_cast<uchar>(div255(d[c] * (255 - a) + color[c] * a));
+	}
+}
+
+// A primitive converted to a shape with a distance function
+struct Shape
+{
+	enum Kind
+	{
+		Capsule, // segment a-b, radius = half of the thickness
+		Box,     // pixel centers from a (top left) to b (bottom right) are fully covered
+		Ellipse, // center a, b = (1 / semi axis x^2, 1 / semi axis y^2), rotation cosA/sinA, radius = half of the thickness, negative for filled
+	};
+
+	Kind kind;
+	cv::Point2f a, b;
+	float radius{ 0 };
+	float cosA{ 1 }, sinA{ 0 };
+	cv::Rect bounds; // pixels which may be covered
+	uchar color[3];
+};
+
+// Coverage of pixels, scalar and 4 pixels at once
+struct CapsuleCoverage
+{
+	explicit CapsuleCoverage(const Shape& s)
+		: ax(s.a.x), ay(s.a.y), dx(s.b.x - s.a.x), dy(s.b.y - s.a.y), r(s.radius + 0.5f)
+	{
+		float length2{ dx * dx + dy * dy };
+		invLength2 = length2 > 0 ? 1 / length2 : 0;
+	}
+
+	// Distance to the closest point of the segment
+	float distance(float x, float y) const
+	{
+		float px{ x - ax }, py{ y - ay };
+		float t{ std::clamp((px * dx + py * dy) * invLength2, 0.f, 1.f) };
+		float ex{ px - t * dx }, ey{ py - t * dy };
+		return std::sqrt(ex * ex + ey * ey);
+	}
+
+	float operator()(float x, float y) const
+	{
+		return std::clamp(r - distance(x, y), 0.f, 1.f);
+	}
+
+#if CV_SIMD128
+	cv::v_float32x4 operator()(const cv::v_float32x4& x, float y) const
+	{
+		const cv::v_float32x4 zero{ cv::v_setzero_f32() }, one{ cv::v_setall_f32(1) };
+		cv::v_float32x4 px{ x - cv::v_setall_f32(ax) };
+		cv::v_float32x4 py{ cv::v_setall_f32(y - ay) };
+		cv::v_float32x4 vdx{ cv::v_setall_f32(dx) }, vdy{ cv::v_setall_f32(dy) };
+
+		cv::v_float32x4 t{ cv::v_min(cv::v_max((px * vdx + py * vdy) * cv::v_setall_f32(invLength2), zero), one) };
+		cv::v_float32x4 ex{ px - t * vdx }, ey{ py - t * vdy };
+		return cv::v_min(cv::v_max(cv::v_setall_f32(r) - cv::v_sqrt(ex * ex + ey * ey), zero), one);
+	}
+#endif
+
+	float ax, ay, dx, dy, r, invLength2;
+};
+
+struct BoxCoverage
+{
+	explicit BoxCoverage(const Shape& s)
+		: x0(s.a.x), y0(s.a.y), x1(s.b.x), y1(s.b.y)
+	{}
+
+	float operator()(float x, float y) const
+	{
+		float cx{ std::clamp(std::min(x - x0, x1 - x) + 1, 0.f, 1.f) };
+		float cy{ std::clamp(std::min(y - y0, y1 - y) + 1, 0.f, 1.f) };
+		return cx * cy;
+	}
+
+#if CV_SIMD128
+	cv::v_float32x4 operator()(const cv::v_float32x4& x, float y) const
+	{
+		const cv::v_float32x4 zero{ cv::v_setzero_f32() }, one{ cv::v_setall_f32(1) };
+		cv::v_float32x4 cx{ cv::v_min(x - cv::v_setall_f32(x0), cv::v_setall_f32(x1) - x) + one };
+		cx = cv::v_min(cv::v_max(cx, zero), one);
+		return cx * cv::v_setall_f32(std::clamp(std::min(y - y0, y1 - y) + 1, 0.f, 1.f));
+	}
+#endif
+
+	float x0, y0, x1, y1;
+};
+
+struct EllipseCoverage
+{
+	explicit EllipseCoverage(const Shape& s)
+		: cx(s.a.x), cy(s.a.y), ia(s.b.x), ib(s.b.y), c(s.cosA), sn(s.sinA), halfThickness(s.radius)
+	{}
+
+	// Approximate signed distance to the edge, (f - 1) / |grad f| for f = x^2 / A^2 + y^2 / B^2, exact on the edge
+	float operator()(float x, float y) const
+	{
+		float dx{ x - cx }, dy{ y - cy };
+		float u{ c * dx + sn * dy }, v{ c * dy - sn * dx };
+		float f{ u * u * ia + v * v * ib };
+		float g{ 2 * std::sqrt(u * u * ia * ia + v * v * ib * ib) };
+		float d{ (f - 1) / std::max(g, 1e-6f) };
+
+		if (halfThickness < 0)
+			return std::clamp(0.5f - d, 0.f, 1.f);
+		return std::clamp(halfThickness + 0.5f - std::abs(d), 0.f, 1.f);
+	}
+
+#if CV_SIMD128
+	cv::v_float32x4 operator()(const cv::v_float32x4& x, float y) const
+	{
+		const cv::v_float32x4 zero{ cv::v_setzero_f32() }, one{ cv::v_setall_f32(1) };
+		const cv::v_float32x4 vc{ cv::v_setall_f32(c) }, vs{ cv::v_setall_f32(sn) };
+		const cv::v_float32x4 via{ cv::v_setall_f32(ia) }, vib{ cv::v_setall_f32(ib) };
+
+		cv::v_float32x4 dx{ x - cv::v_setall_f32(cx) }, dy{ cv::v_setall_f32(y - cy) };
+		cv::v_float32x4 u{ vc * dx + vs * dy }, v{ vc * dy - vs * dx };
+		cv::v_float32x4 uu{ u * u }, vv{ v * v };
+		cv::v_float32x4 f{ uu * via + vv * vib };
+		cv::v_float32x4 g{ cv::v_setall_f32(2) * cv::v_sqrt(uu * via * via + vv * vib * vib) };
+		cv::v_float32x4 d{ (f - one) / cv::v_max(g, cv::v_setall_f32(1e-6f)) };
+
+		cv::v_float32x4 coverage;
+		if (halfThickness < 0)
+			coverage = cv::v_setall_f32(0.5f) - d;
+		else
+			coverage = cv::v_setall_f32(halfThickness + 0.5f) - cv::v_abs(d);
+
+		return cv::v_min(cv::v_max(coverage, zero), one);
+	}
+#endif
+
+	float cx, cy, ia, ib, c, sn, halfThickness;
+};
+
+/**
+ * Collects primitives and draws them in one parallel pass.
+ * Colors are BGR, thickness is in pixels like in the cv:: drawing functions (negative thickness means filled for
+ * circles, ellipses and rectangles). The target image must be CV_8UC3.
+ */
+class BatchRenderer
+{
+public:
+	static constexpr int TILE_SIZE{ 64 };
+
+	void line(cv::Point2f p0, cv::Point2f p1, const cv::Scalar& color, float thickness = 1)
+	{
+		Shape s{ makeShape(Shape::Capsule, color) };
+		s.a = p0;
+		s.b = p1;
+		s.radius = std::max(thickness, 1.f) / 2;
+
+		float margin{ s.radius + 1 };
+		s.bounds = boundsOf(std::min(p0.x, p1.x) - margin, std::min(p0.y, p1.y) - margin,
+			std::max(p0.x, p1.x) + margin, std::max(p0.y, p1.y) + margin);
+		shapes_.push_back(s);
+	}
+
+	void ellipse(cv::Point2f center, cv::Size2f semiAxes, float angleDegrees, const cv::Scalar& color, float thickness = 1)
+	{
+		Shape s{ makeShape(Shape::Ellipse, color) };
+		float a{ std::max(semiAxes.width, 0.5f) }, b{ std::max(semiAxes.height, 0.5f) };
+		float angle{ angleDegrees * static_cast<float>(CV_PI) / 180 };
+
+		s.a = center;
+		s.b = cv::Point2f(1 / (a * a), 1 / (b * b));
+		s.cosA = std::cos(angle);
+		s.sinA = std::sin(angle);
+		s.radius = thickness < 0 ? -1 : std::max(thickness, 1.f) / 2;
+
+		// Extent of the rotated ellipse
+		float ex{ std::sqrt(a * a * s.cosA * s.cosA + b * b * s.sinA * s.sinA) };
+		float ey{ std::sqrt(a * a * s.sinA * s.sinA + b * b * s.cosA * s.cosA) };
+		float margin{ std::max(s.radius, 0.f) + 1 };
+		s.bounds = boundsOf(center.x - ex - margin, center.y - ey - margin, center.x + ex + margin, center.y + ey + margin);
+		shapes_.push_back(s);
+	}
+
+	void circle(cv::Point2f center, float radius, const cv::Scalar& color, float thickness = 1)
+	{
+		ellipse(center, cv::Size2f(radius, radius), 0, color, thickness);
+	}
+
+	// For an integer rect the same pixels as cv::rectangle(img, rect, ..., cv::LINE_8), columns rect.x ...
+	// rect.x + rect.width - 1, except the outer corners of thick outlines, which cv::rectangle rounds
+	void rectangle(const cv::Rect2f& rect, const cv::Scalar& color, float thickness = 1)
+	{
+		const float x0{ rect.x }, y0{ rect.y }, x1{ rect.x + rect.width - 1 }, y1{ rect.y + rect.height - 1 };
+
+		if (thickness < 0)
+		{
+			box(x0, y0, x1, y1, color);
+			return;
+		}
+
+		// Whole pixels on both sides of the edge, like cv::rectangle: thickness 1 is 1 pixel, 2 is 3, 3 and 4 are 5...
+		const int t{ std::max(cvRound(thickness), 1) };
+		const int h{ t == 1 ? 0 : (t + 1) / 2 };
+
+		// The bands would overlap, the hole is closed
+		if (x1 - x0 <= 2 * h or y1 - y0 <= 2 * h)
+		{
+			box(x0 - h, y0 - h, x1 + h, y1 + h, color);
+			return;
+		}
+
+		// Four bands centered on the edges, the vertical ones between the horizontal ones, so every pixel is blended once
+		box(x0 - h, y0 - h, x1 + h, y0 + h, color);
+		box(x0 - h, y1 - h, x1 + h, y1 + h, color);
+		box(x0 - h, y0 + h + 1, x0 + h, y1 - h - 1, color);
+		box(x1 - h, y0 + h + 1, x1 + h, y1 - h - 1, color);
+	}
+
+	template<typename P>
+	void polyline(const std::vector<P>& points, bool closed, const cv::Scalar& color, float thickness = 1)
+	{
+		for (size_t i{ 1 }; i < points.size(); ++i)
+			line(cv::Point2f(points[i - 1]), cv::Point2f(points[i]), color, thickness);
+
+		if (closed and points.size() > 2)
+			line(cv::Point2f(points.back()), cv::Point2f(points.front()), color, thickness);
+	}
+
+	// Arrays in the formats produced by OpenCV: cv::HoughLinesP, cv::HoughCircles, cv::fitEllipse, cv::findContours
+
+	template<typename T>
+	void lines(const std::vector<cv::Vec<T, 4>>& segments, const cv::Scalar& color, float thickness = 1)
+	{
+		for (const auto& l : segments)
+			line(cv::Point2f(static_cast<float>(l[0]), static_cast<float>(l[1])), cv::Point2f(static_cast<float>(l[2]), static_cast<float>(l[3])), color, thickness);
+	}
+
+	void circles(const std::vector<cv::Vec3f>& circles, const cv::Scalar& color, float thickness = 1)
+	{
+		for (const auto& c : circles)
+			circle(cv::Point2f(c[0], c[1]), c[2], color, thickness);
+	}
+
+	void ellipses(const std::vector<cv::RotatedRect>& boxes, const cv::Scalar& color, float thickness = 1)
+	{
+		for (const auto& b : boxes)
+			ellipse(b.center, cv::Size2f(b.size.width / 2, b.size.height / 2), b.angle, color, thickness);
+	}
+
+	template<typename R>
+	void rectangles(const std::vector<R>& rects, const cv::Scalar& color, float thickness = 1)
+	{
+		for (const auto& r : rects)
+			rectangle(cv::Rect2f(r), color, thickness);
+	}
+
+	template<typename P>
+	void polylines(const std::vector<std::vector<P>>& curves, bool closed, const cv::Scalar& color, float thickness = 1)
+	{
+		for (const auto& curve : curves)
+			polyline(curve, closed, color, thickness);
+	}
+
+	size_t size() const { return shapes_.size(); }
+	void clear() { shapes_.clear(); }
+
+	/**
+	 * \brief Draw all collected primitives in the order they were added.
+	 * \param img Target image (CV_8UC3).
+	 */
+	void render(cv::Mat& img) const
+	{
+		CV_Assert(img.type() == CV_8UC3);
+
+		const int tilesX{ (img.cols + TILE_SIZE - 1) / TILE_SIZE };
+		const int tilesY{ (img.rows + TILE_SIZE - 1) / TILE_SIZE };
+		const cv::Rect imageRect(0, 0, img.cols, img.rows);
+
+		// Binning, shape indices stay in drawing order in every tile
+		std::vector<std::vector<int>> bins(static_cast<size_t>(tilesX) * tilesY);
+		for (int i{ 0 }; i < static_cast<int>(shapes_.size()); ++i)
+		{
+			const Shape& s{ shapes_[i] };
+			cv::Rect r{ s.bounds & imageRect };
+			if (r.empty())
+				continue;
+
+			for (int ty{ r.y / TILE_SIZE }; ty <= (r.y + r.height - 1) / TILE_SIZE; ++ty)
+			{
+				for (int tx{ r.x / TILE_SIZE }; tx <= (r.x + r.width - 1) / TILE_SIZE; ++tx)
+				{
+					// Long diagonal lines have big bounds, but touch only a few of the tiles inside
+					if (s.kind == Shape::Capsule and !capsuleTouchesTile(s, tx, ty))
+						continue;
+
+					bins[static_cast<size_t>(ty) * tilesX + tx].push_back(i);
+				}
+			}
+		}
+
+		cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range)
+		{
+			uchar alpha[TILE_SIZE];
+
+			for (int t{ range.start }; t < range.end; ++t)
+			{
+				const cv::Rect tile{ cv::Rect((t % tilesX) * TILE_SIZE, (t / tilesX) * TILE_SIZE, TILE_SIZE, TILE_SIZE) & imageRect };
+
+				for (int i : bins[t])
+				{
+					const Shape& s{ shapes_[i] };
+					const cv::Rect area{ s.bounds & tile };
+
+					switch (s.kind)
+					{
+					case Shape::Capsule: drawShape(img, s, area, CapsuleCoverage(s), alpha); break;
+					case Shape::Box: drawShape(img, s, area, BoxCoverage(s), alpha); break;
+					case Shape::Ellipse: drawShape(img, s, area, EllipseCoverage(s), alpha); break;
+					}
+				}
+			}
+		});
+	}
+
+private:
+	static Shape makeShape(Shape::Kind kind, const cv::Scalar& color)
+	{
+		Shape s;
+		s.kind = kind;
+		for (int c{ 0 }; c < 3; ++c)
+			s.color[c] = cv::saturate_cast<uchar>(color[c]);
+		return s;
+	}
+
+	static cv::Rect boundsOf(float x0, float y0, float x1, float y1)
+	{
+		int left{ cvFloor(x0) }, top{ cvFloor(y0) };
+		return cv::Rect(left, top, cvCeil(x1) - left + 1, cvCeil(y1) - top + 1);
+	}
+
+	void box(float x0, float y0, float x1, float y1, const cv::Scalar& color)
+	{
+		if (x1 < x0 or y1 < y0)
+			return;
+
+		Shape s{ makeShape(Shape::Box, color) };
+		s.a = cv::Point2f(x0, y0);
+		s.b = cv::Point2f(x1, y1);
+		s.bounds = boundsOf(x0 - 1, y0 - 1, x1 + 1, y1 + 1);
+		shapes_.push_back(s);
+	}
+
+	static bool capsuleTouchesTile(const Shape& s, int tx, int ty)
+	{
+		// Distance from the tile center to the segment compared with the tile half diagonal
+		const float half{ TILE_SIZE / 2.f };
+		const cv::Point2f center{ tx * TILE_SIZE + half - 0.5f, ty * TILE_SIZE + half - 0.5f };
+
+		return CapsuleCoverage(s).distance(center.x, center.y) <= s.radius + 1 + half * 1.4143f;
+	}
+
+	// Columns of row y which can be covered by a capsule
+	static void capsuleSpan(const Shape& s, int y, int& x0, int& x1)
+	{
+		// Every covered pixel is within r of a segment point, so that point is at most r rows away
+		const float r{ s.radius + 1 };
+		const float dy{ s.b.y - s.a.y };
+		float lo{ 0 }, hi{ 1 };
+
+		if (std::abs(dy) < 1e-6f)
+		{
+			if (std::abs(y - s.a.y) > r)
+			{
+				x1 = x0;
+				return;
+			}
+		}
+		else
+		{
+			float ta{ (y - r - s.a.y) / dy }, tb{ (y + r - s.a.y) / dy };
+			lo = std::max(0.f, std::min(ta, tb));
+			hi = std::min(1.f, std::max(ta, tb));
+			if (lo > hi)
+			{
+				x1 = x0;
+				return;
+			}
+		}
+
+		float xa{ s.a.x + lo * (s.b.x - s.a.x) }, xb{ s.a.x + hi * (s.b.x - s.a.x) };
+		x0 = std::max(x0, cvFloor(std::min(xa, xb) - r));
+		x1 = std::min(x1, cvCeil(std::max(xa, xb) + r) + 1);
+	}
+
+	template<typename Coverage>
+	static void drawShape(cv::Mat& img, const Shape& s, const cv::Rect& area, const Coverage& coverage, uchar* alpha)
+	{
+		for (int y{ area.y }; y < area.y + area.height; ++y)
+		{
+			int x0{ area.x }, x1{ area.x + area.width };
+			if (s.kind == Shape::Capsule)
+				capsuleSpan(s, y, x0, x1);
+
+			const int n{ x1 - x0 };
+			if (n <= 0)
+				continue;
+
+			const float fy{ static_cast<float>(y) };
+			int i{ 0 };
+
+#if CV_SIMD128
+			// Coverage of 16 pixels, 4 at a time, converted to 0 - 255
+			static const float ramp[4]{ 0, 1, 2, 3 };
+			const cv::v_float32x4 scale{ cv::v_setall_f32(255) };
+			const cv::v_float32x4 four{ cv::v_setall_f32(4) };
+
+			for (; i <= n - 16; i += 16)
+			{
+				cv::v_float32x4 xs{ cv::v_setall_f32(static_cast<float>(x0 + i)) + cv::v_load(ramp) };
+				cv::v_int32x4 q[4];
+				for (int k{ 0 }; k < 4; ++k)
+				{
+					q[k] = cv::v_round(coverage(xs, fy) * scale);
+					xs = xs + four;
+				}
+
+				cv::v_store(alpha + i, cv::v_pack_u(cv::v_pack(q[0], q[1]), cv::v_pack(q[2], q[3])));
+			}
+#endif
+
+			for (; i < n; ++i)
+				alpha[i] = static_cast<uchar>(cvRound(coverage(static_cast<float>(x0 + i), fy) * 255));
+
+			blendSpan(img.ptr<uchar>(y) + 3 * x0, alpha, n, s.color);
+		}
+	}
+
+	std::vector<Shape> shapes_;
+};
+
+/**
+ * \brief Median time of a function in milliseconds.
+ * \param func Function to measure.
+ * \param repetitions Number of measured calls.
+ * \return Median time in milliseconds.
+ */
+template<typename Func>
+double medianMs(Func&& func, int repetitions = 9)
+{
+	std::vector<double> times;
+	for (int i{ 0 }; i < repetitions; ++i)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		func();
+		auto stop = std::chrono::high_resolution_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+
+int main()
+{
+	const cv::Size size(1920, 1080);
+	const int count{ 10000 };
+
+	// Random primitives, fixed seed
+	cv::RNG rng(42);
+
+	std::vector<cv::Vec4i> segments;
+	std::vector<cv::Vec3f> circles;
+	std::vector<cv::RotatedRect> ellipses;
+	std::vector<cv::Rect> rects;
+	std::vector<std::vector<cv::Point>> contours;
+
+	for (int i{ 0 }; i < count / 5; ++i)
+	{
+		cv::Point p{ rng.uniform(0, size.width), rng.uniform(0, size.height) };
+
+		segments.emplace_back(p.x, p.y, p.x + rng.uniform(-60, 60), p.y + rng.uniform(-60, 60));
+		circles.emplace_back(static_cast<float>(p.x), static_cast<float>(p.y), rng.uniform(3.f, 30.f));
+		ellipses.emplace_back(cv::Point2f(p), cv::Size2f(rng.uniform(6.f, 60.f), rng.uniform(6.f, 40.f)), rng.uniform(0.f, 180.f));
+		rects.emplace_back(p.x, p.y, rng.uniform(4, 60), rng.uniform(4, 60));
+
+		std::vector<cv::Point> contour;
+		for (int k{ 0 }; k < 6; ++k)
+			contour.emplace_back(p.x + rng.uniform(-30, 30), p.y + rng.uniform(-30, 30));
+		contours.push_back(contour);
+	}
+
+	const cv::Scalar green(0, 255, 0), red(0, 0, 255), blue(255, 0, 0), yellow(0, 255, 255), magenta(255, 0, 255);
+	const cv::Mat background(size, CV_8UC3, cv::Scalar(40, 40, 40));
+
+	// One call per primitive
+	cv::Mat opencvImage;
+	double opencvMs{ medianMs([&]
+	{
+		background.copyTo(opencvImage);
+		for (const auto& l : segments)
+			cv::line(opencvImage, cv::Point(l[0], l[1]), cv::Point(l[2], l[3]), green, 1, cv::LINE_AA);
+		for (const auto& c : circles)
+			cv::circle(opencvImage, cv::Point(cvRound(c[0]), cvRound(c[1])), cvRound(c[2]), red, 2, cv::LINE_AA);
+		for (const auto& e : ellipses)
+			cv::ellipse(opencvImage, e, blue, 1, cv::LINE_AA);
+		for (const auto& r : rects)
+			cv::rectangle(opencvImage, r, yellow, 1, cv::LINE_AA);
+		cv::polylines(opencvImage, contours, true, magenta, 1, cv::LINE_AA);
+	}) };
+
+	// Batched
+	cv::Mat batchImage;
+	BatchRenderer renderer;
+	double batchMs{ medianMs([&]
+	{
+		background.copyTo(batchImage);
+		renderer.clear();
+		renderer.lines(segments, green, 1);
+		renderer.circles(circles, red, 2);
+		renderer.ellipses(ellipses, blue, 1);
+		renderer.rectangles(rects, yellow, 1);
+		renderer.polylines(contours, true, magenta, 1);
+		renderer.render(batchImage);
+	}) };
+
+	std::cout << "Primitives: " << count << std::endl;
+	std::cout << "cv:: calls with LINE_AA: " << opencvMs << " ms" << std::endl;
+	std::cout << "BatchRenderer: " << batchMs << " ms (" << renderer.size() << " shapes)" << std::endl;
+
+	// The anti-aliasing is not the same, but the images should be close
+	cv::Mat difference;
+	cv::absdiff(opencvImage, batchImage, difference);
+	std::cout << "Mean absolute difference: " << cv::mean(difference)[0] << std::endl;
+
+	// Thick outlines, even and odd thickness. Without anti-aliasing cv::rectangle draws the same bands, only its outer
+	// corners are rounded. Rectangles crossing the border are left out, cv::rectangle clips them differently
+	const cv::Rect interior(8, 8, size.width - 16, size.height - 16);
+	std::vector<cv::Rect> inside;
+	for (const auto& r : rects)
+		if ((r & interior) == r)
+			inside.push_back(r);
+
+	for (int thickness : { 2, 3, 4 })
+	{
+		cv::Mat expected{ cv::Mat::zeros(size, CV_8UC3) };
+		for (const auto& r : inside)
+			cv::rectangle(expected, r, yellow, thickness, cv::LINE_8);
+
+		cv::Mat result{ cv::Mat::zeros(size, CV_8UC3) };
+		renderer.clear();
+		renderer.rectangles(inside, yellow, static_cast<float>(thickness));
+		renderer.render(result);
+
+		cv::Mat expectedMask, resultMask;
+		cv::extractChannel(expected, expectedMask, 1);
+		cv::extractChannel(result, resultMask, 1);
+		std::cout << "Rectangles with thickness " << thickness << ": " << cv::countNonZero(resultMask > expectedMask)
+			<< " pixels only in BatchRenderer (square corners), " << cv::countNonZero(expectedMask > resultMask)
+			<< " only in cv::rectangle" << std::endl;
+	}
+
+	cv::imwrite("overlay_opencv.png", opencvImage);
+	cv::imwrite("overlay_batch.png", batchImage);
+
+	return 0;
+}
@@ -0,0 +1,404 @@
+/*
+ * Glyph atlas text rendering
+ * cv::putText (26_drawing_text, 04_take_inputs_from_keyboard) draws the Hershey fonts as polylines: every call of
+ * cv::putText converts every character of the string to strokes and rasterizes them again, and cv::getTextSize walks
+ * the strokes of the string again just to measure it. A HUD which shows hundreds of labels every frame pays for
+ * rasterizing the same few dozen characters over and over.
+ *
+ * TextRenderer rasterizes every printable ASCII character only once for every combination of
+ * (font face, font scale, thickness, line type) and keeps the results in a glyph atlas:
+ *	- the glyph is drawn with cv::putText into a small single-channel image, white on black; the values are the
+ *	  coverage of the pixels (with cv::LINE_AA the edges have values between 0 and 255),
+ *	- the glyph is cropped to its bounding box and copied into the atlas together with its offset from the pen position
+ *	  and the horizontal advance of the pen.
+ * Drawing a string is then only blending the color through the coverage masks of its glyphs, with the same 16 pixels
+ * per iteration SIMD blend as in 04_batched_rasterizer. Sizes of strings (getTextSize) are cached as well, because
+ * labels are usually the same in every frame.
+ *
+ * TextRenderer::putText and TextRenderer::getTextSize have the same arguments as the cv:: functions, so they can be
+ * used as a replacement. The pen advances by fractions of a pixel like in cv::putText, but every glyph is placed at a
+ * whole pixel, so the result can differ from cv::putText by a pixel here and there.
+ *
+ * The program draws a few hundred labels with cv::putText and with TextRenderer and prints both times.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+
+// div255() and blendSpan() are copied from 07_performance/04_batched_rasterizer
+inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 div255(const cv::v_uint16x8& x)
+{
+	cv::v_uint16x8 t{ cv::v_add_wrap(x, cv::v_setall_u16(128)) };
+	return cv::v_shr<8>(cv::v_add_wrap(t, cv::v_shr<8>(t)));
+}
+#endif
+
+void blendSpan(uchar* dst, const uchar* alpha, int width, const uchar (&color)[3])
+{
+	int x{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint8x16 zero{ cv::v_setzero_u8() };
+	const cv::v_uint8x16 maxAlpha{ cv::v_setall_u8(255) };
+	const cv::v_uint8x16 colors[3]{ cv::v_setall_u8(color[0]), cv::v_setall_u8(color[1]), cv::v_setall_u8(color[2]) };
+
+	for (; x <= width - 16; x += 16)
+	{
+		cv::v_uint8x16 a{ cv::v_load(alpha + x) };
+
+		// Nothing covered
+		if (!cv::v_check_any(a != zero))
+			continue;
+
+		cv::v_uint8x16 d[3];
+		cv::v_load_deinterleave(dst + 3 * x, d[0], d[1], d[2]);
+
+		cv::v_uint8x16 inverse{ maxAlpha - a };
+		for (int c{ 0 }; c < 3; ++c)
+		{
+			cv::v_uint16x8 low0, high0, low1, high1;
+			cv::v_mul_expand(d[c], inverse, low0, high0);
+			cv::v_mul_expand(colors[c], a, low1, high1);
+			d[c] = cv::v_pack(div255(cv::v_add_wrap(low0, low1)), div255(cv::v_add_wrap(high0, high1)));
+		}
+
+		cv::v_store_interleave(dst + 3 * x, d[0], d[1], d[2]);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		const int a{ alpha[x] };
+		if (a == 0)
+			continue;
+
+		uchar* d{ dst + 3 * x };
+		for (int c{ 0 }; c < 3; ++c)
+			d[c] = static_cast<uchar>(div255(d[c] * (255 - a) + color[c] * a));
+	}
+}
+
+// Position of one character in the atlas
+struct Glyph
+{
+	cv::Rect rect;   // coverage mask in the atlas, empty for space
+	cv::Point offset; // top left corner of the mask relative to the pen position (on the baseline)
+	double advance{ 0 }; // how far the pen moves after the character, fractional like in cv::putText
+};
+
+/**
+ * Pre-rasterized printable ASCII characters (32 - 126) of one font face, scale, thickness and line type.
+ * Other characters are drawn as '?', like cv::putText does.
+ */
+class GlyphAtlas
+{
+public:
+	static constexpr int FIRST{ 32 };
+	static constexpr int LAST{ 126 };
+	static constexpr size_t MAX_CACHED_SIZES{ 4096 };
+	static constexpr int ADVANCE_REPEAT{ 32 }; // characters measured together to get the fraction of the advance
+
+	GlyphAtlas(int fontFace, double fontScale, int thickness, int lineType)
+		: fontFace_(fontFace), fontScale_(fontScale), thickness_(thickness)
+	{
+		// Glyphs are drawn on a canvas large enough for any of them and cropped
+		int baseline{ 0 };
+		cv::Size maxSize{ cv::getTextSize("W", fontFace, fontScale, thickness, &baseline) };
+		const int pad{ thickness + 2 };
+		const cv::Size canvasSize(2 * maxSize.width + 2 * pad, maxSize.height + 2 * baseline + 2 * pad);
+		const cv::Point origin(pad, pad + maxSize.height);
+
+		std::vector<cv::Mat> masks(LAST - FIRST + 1);
+		int atlasWidth{ 0 }, atlasHeight{ 0 };
+
+		for (int c{ FIRST }; c <= LAST; ++c)
+		{
+			const std::string text(1, static_cast<char>(c));
+			Glyph& glyph{ glyphs_[c - FIRST] };
+
+			// cv::getTextSize adds the thickness to the width of the strokes and rounds the width, the advance of a
+			// repeated character keeps the fraction
+			const std::string repeated(ADVANCE_REPEAT, static_cast<char>(c));
+			glyph.advance = (cv::getTextSize(repeated, fontFace, fontScale, thickness, &baseline).width - thickness)
+				/ static_cast<double>(ADVANCE_REPEAT);
+
+			cv::Mat canvas{ cv::Mat::zeros(canvasSize, CV_8UC1) };
+			cv::putText(canvas, text, origin, fontFace, fontScale, cv::Scalar(255), thickness, lineType);
+
+			// Bounding box of the non zero pixels, empty for space
+			cv::Rect box{ cv::boundingRect(canvas) };
+			if (box.empty())
+				continue;
+
+			glyph.offset = box.tl() - origin;
+			glyph.rect = cv::Rect(atlasWidth, 0, box.width, box.height);
+			masks[c - FIRST] = canvas(box);
+
+			atlasWidth += box.width;
+			atlasHeight = std::max(atlasHeight, box.height);
+		}
+
+		// One image with all glyphs side by side
+		atlas_ = cv::Mat::zeros(std::max(atlasHeight, 1), std::max(atlasWidth, 1), CV_8UC1);
+		for (int c{ FIRST }; c <= LAST; ++c)
+			if (!masks[c - FIRST].empty())
+				masks[c - FIRST].copyTo(atlas_(glyphs_[c - FIRST].rect));
+	}
+
+	const Glyph& glyph(char c) const
+	{
+		int code{ static_cast<unsigned char>(c) };
+		if (code < FIRST or code > LAST)
+			code = '?';
+		return glyphs_[code - FIRST];
+	}
+
+	/**
+	 * \brief Same result as cv::getTextSize, cached for strings measured before.
+	 */
+	cv::Size textSize(const std::string& text, int* baseLine)
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+
+		auto it{ sizes_.find(text) };
+		if (it == sizes_.end())
+		{
+			// Labels which change every frame (counters, scores) would fill the cache, start over when it is too big
+			if (sizes_.size() >= MAX_CACHED_SIZES)
+				sizes_.clear();
+
+			int baseline{ 0 };
+			cv::Size size{ cv::getTextSize(text, fontFace_, fontScale_, thickness_, &baseline) };
+			it = sizes_.emplace(text, std::make_pair(size, baseline)).first;
+		}
+
+		if (baseLine)
+			*baseLine = it->second.second;
+		return it->second.first;
+	}
+
+	/**
+	 * \brief Draw a string, org is the bottom left corner of the text like in cv::putText.
+	 */
+	void draw(cv::Mat& img, const std::string& text, cv::Point org, const uchar (&color)[3]) const
+	{
+		const cv::Rect imageRect(0, 0, img.cols, img.rows);
+		double penX{ static_cast<double>(org.x) };
+
+		for (char c : text)
+		{
+			const Glyph& g{ glyph(c) };
+
+			if (!g.rect.empty())
+			{
+				// The pen moves by fractions of a pixel, only the position of the glyph is rounded
+				const cv::Point pen(cvRound(penX), org.y);
+
+				// Visible part of the glyph
+				const cv::Rect target{ cv::Rect(pen + g.offset, g.rect.size()) & imageRect };
+				const cv::Point skip{ target.tl() - (pen + g.offset) };
+
+				for (int y{ 0 }; y < target.height; ++y)
+				{
+					const uchar* mask{ atlas_.ptr<uchar>(g.rect.y + skip.y + y) + g.rect.x + skip.x };
+					blendSpan(img.ptr<uchar>(target.y + y) + 3 * target.x, mask, target.width, color);
+				}
+			}
+
+			penX += g.advance;
+		}
+	}
+
+	const cv::Mat& atlas() const { return atlas_; }
+
+private:
+	int fontFace_;
+	double fontScale_;
+	int thickness_;
+
+	cv::Mat atlas_;
+	std::array<Glyph, LAST - FIRST + 1> glyphs_;
+
+	std::mutex mutex_;
+	std::unordered_map<std::string, std::pair<cv::Size, int>> sizes_;
+};
+
+/**
+ * Replacement of cv::putText and cv::getTextSize with cached glyphs. Thread safe.
+ */
+class TextRenderer
+{
+public:
+	/**
+	 * \brief Same arguments as cv::putText, the image must be CV_8UC3.
+	 */
+	void putText(cv::Mat& img, const std::string& text, cv::Point org, int fontFace, double fontScale, const cv::Scalar& color,
+		int thickness = 1, int lineType = cv::LINE_8)
+	{
+		CV_Assert(img.type() == CV_8UC3);
+
+		const uchar bgr[3]{ cv::saturate_cast<uchar>(color[0]), cv::saturate_cast<uchar>(color[1]), cv::saturate_cast<uchar>(color[2]) };
+		atlas(fontFace, fontScale, thickness, lineType).draw(img, text, org, bgr);
+	}
+
+	/**
+	 * \brief Same arguments and result as cv::getTextSize.
+	 */
+	cv::Size getTextSize(const std::string& text, int fontFace, double fontScale, int thickness, int* baseLine)
+	{
+		// The size does not depend on the line type, any atlas of the font will do
+		return atlas(fontFace, fontScale, thickness, ANY_LINE_TYPE).textSize(text, baseLine);
+	}
+
+	size_t atlasCount() const
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		return atlases_.size();
+	}
+
+private:
+	using Key = std::tuple<int, double, int, int>; // font face, scale, thickness, line type
+
+	// Line type for atlas() when only the metrics are needed, lower than any real one (cv::FILLED is -1)
+	static constexpr int ANY_LINE_TYPE{ std::numeric_limits<int>::min() };
+
+	GlyphAtlas& atlas(int fontFace, double fontScale, int thickness, int lineType)
+	{
+		thickness = std::max(thickness, 1);
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+
+		// The line type is the last part of the key, so the first key not less than (font, ANY_LINE_TYPE) is an atlas of
+		// this font if there is one
+		if (lineType == ANY_LINE_TYPE)
+		{
+			auto any{ atlases_.lower_bound(Key{ fontFace, fontScale, thickness, ANY_LINE_TYPE }) };
+			if (any != atlases_.end() and std::get<0>(any->first) == fontFace and std::get<1>(any->first) == fontScale
+				and std::get<2>(any->first) == thickness)
+				return *any->second;
+
+			lineType = cv::LINE_8;
+		}
+
+		const Key key{ fontFace, fontScale, thickness, lineType };
+		auto it{ atlases_.find(key) };
+		if (it == atlases_.end())
+			it = atlases_.emplace(key, std::make_unique<GlyphAtlas>(fontFace, fontScale, thickness, lineType)).first;
+
+		return *it->second;
+	}
+
+	mutable std::mutex mutex_;
+	std::map<Key, std::unique_ptr<GlyphAtlas>> atlases_;
+};
+
+/**
+ * \brief Median time of a function in milliseconds.
+ * \param func Function to measure.
+ * \param repetitions Number of measured calls.
+ * \return Median time in milliseconds.
+ */
+template<typename Func>
+double medianMs(Func&& func, int repetitions = 15)
+{
+	std::vector<double> times;
+	for (int i{ 0 }; i < repetitions; ++i)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		func();
+		auto stop = std::chrono::high_resolution_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+
+int main()
+{
+	const cv::Size size(1280, 720);
+	const cv::Mat background(size, CV_8UC3, cv::Scalar(60, 60, 60));
+
+	// Labels of a HUD, fixed seed
+	struct Label
+	{
+		std::string text;
+		cv::Point org;
+	};
+
+	cv::RNG rng(42);
+	std::vector<Label> labels;
+	for (int i{ 0 }; i < 300; ++i)
+	{
+		std::string text{ "ID " + std::to_string(rng.uniform(1000, 9999)) + " score 0." + std::to_string(rng.uniform(10, 99)) };
+		labels.push_back({ text, cv::Point(rng.uniform(0, size.width - 100), rng.uniform(20, size.height)) });
+	}
+
+	const int fontFace{ cv::FONT_HERSHEY_SIMPLEX };
+	const double fontScale{ 0.5 };
+	const int thickness{ 1 };
+	const cv::Scalar color(0, 255, 255);
+
+	cv::Mat opencvImage;
+	double opencvMs{ medianMs([&]
+	{
+		background.copyTo(opencvImage);
+		for (const auto& l : labels)
+		{
+			int baseline;
+			cv::Size textSize{ cv::getTextSize(l.text, fontFace, fontScale, thickness, &baseline) };
+			cv::rectangle(opencvImage, l.org + cv::Point(0, baseline), l.org + cv::Point(textSize.width, -textSize.height), cv::Scalar(0, 0, 0), cv::FILLED);
+			cv::putText(opencvImage, l.text, l.org, fontFace, fontScale, color, thickness, cv::LINE_AA);
+		}
+	}) };
+
+	TextRenderer renderer;
+	cv::Mat atlasImage;
+	double atlasMs{ medianMs([&]
+	{
+		background.copyTo(atlasImage);
+		for (const auto& l : labels)
+		{
+			int baseline;
+			cv::Size textSize{ renderer.getTextSize(l.text, fontFace, fontScale, thickness, &baseline) };
+			cv::rectangle(atlasImage, l.org + cv::Point(0, baseline), l.org + cv::Point(textSize.width, -textSize.height), cv::Scalar(0, 0, 0), cv::FILLED);
+			renderer.putText(atlasImage, l.text, l.org, fontFace, fontScale, color, thickness, cv::LINE_AA);
+		}
+	}) };
+
+	cv::Mat difference;
+	cv::absdiff(opencvImage, atlasImage, difference);
+
+	std::cout << "Labels: " << labels.size() << std::endl;
+	std::cout << "cv::putText: " << opencvMs << " ms" << std::endl;
+	std::cout << "TextRenderer: " << atlasMs << " ms (" << renderer.atlasCount() << " atlases)" << std::endl;
+	std::cout << "Mean absolute difference: " << cv::mean(difference)[0] << std::endl;
+
+	cv::imwrite("labels_opencv.png", opencvImage);
+	cv::imwrite("labels_atlas.png", atlasImage);
+
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Asynchronous image writer
+ * cv::imwrite (05_saving_an_image, 06_annotation_homework, 27_exercise_build_a_qr) encodes the image and writes the
+ * file on the calling thread. PNG compression of a Full HD frame takes tens of milliseconds, so a program which dumps
+ * its frames for debugging spends more time in cv::imwrite than in the processing itself.
+ *
+ * AsyncImageWriter moves the work to a pool of encoder threads:
+ *	- write() copies the pixels into a queue and returns immediately, writeEncoded() queues bytes which are already
+ *	  encoded (eg. from cv::imencode), those are only written to disk,
+ *	- encoder threads take jobs from the queue, encode them with cv::imencode and write the bytes to the file,
+ *	- the queue is bounded by the number of images and by the number of bytes it holds, so memory does not grow when the
+ *	  disk is slower than the producer. What happens when the queue is full is chosen by BackPressure:
+ *		Block       - write() waits until there is space (nothing is lost, the producer slows down),
+ *		DropNewest  - the new image is not written,
+ *		DropOldest  - the oldest queued image is removed to make space,
+ *		Degrade     - the image is queued at half resolution with a lower JPEG quality and faster PNG compression,
+ *		              which needs 4 times less memory and encodes faster; if even that does not fit, write() waits,
+ *	- flush() waits until everything queued so far is on disk, close() flushes and stops the threads (it is called
+ *	  by the destructor),
+ *	- stats() returns the number of written, dropped and degraded images, the peak memory of the queue and the time
+ *	  spent encoding, writing and waiting for space.
+ *
+ * The program simulates a processing loop which saves every frame and compares cv::imwrite with AsyncImageWriter.
+ *
+ * Usage:
+ *	Source [block|drop-newest|drop-oldest|degrade]
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// What write() does when the queue is full
+enum class BackPressure
+{
+	Block,
+	DropNewest,
+	DropOldest,
+	Degrade,
+};
+
+struct AsyncWriterSettings
+{
+	int encoderThreads{ 2 };
+	size_t maxQueuedImages{ 32 };
+	size_t maxQueuedBytes{ 256 << 20 }; // 256 MB
+	BackPressure backPressure{ BackPressure::Block };
+	int degradedJpegQuality{ 60 };
+	int degradedPngCompression{ 1 };
+};
+
+struct AsyncWriterStats
+{
+	size_t submitted{ 0 };
+	size_t written{ 0 };
+	size_t dropped{ 0 };
+	size_t degraded{ 0 };
+	size_t failed{ 0 };
+	size_t peakQueuedBytes{ 0 };
+	double encodeMs{ 0 };  // sum over all encoder threads
+	double writeMs{ 0 };   // sum over all encoder threads
+	double blockedMs{ 0 }; // time producers waited in write()
+};
+
+/**
+ * Writes images on background threads with a bounded queue.
+ */
+class AsyncImageWriter
+{
+public:
+	explicit AsyncImageWriter(const AsyncWriterSettings& settings = AsyncWriterSettings())
+		: settings_(settings)
+	{
+		for (int i{ 0 }; i < std::max(1, settings_.encoderThreads); ++i)
+			workers_.emplace_back(&AsyncImageWriter::run, this);
+	}
+
+	~AsyncImageWriter()
+	{
+		close();
+	}
+
+	AsyncImageWriter(const AsyncImageWriter&) = delete;
+	AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+	/**
+	 * \brief Queue an image, same arguments as cv::imwrite. The pixels are copied, img can be reused right away.
+	 * \param path File name, the extension selects the format.
+	 * \param img Image.
+	 * \param params Format specific parameters (cv::IMWRITE_*).
+	 * \return False if the image was dropped or the writer is closed.
+	 */
+	bool write(const std::string& path, const cv::Mat& img, const std::vector<int>& params = std::vector<int>())
+	{
+		Job job;
+		job.path = path;
+		job.params = params;
+		job.pixels = img.clone();
+		job.bytes = job.pixels.total() * job.pixels.elemSize();
+
+		return enqueue(std::move(job));
+	}
+
+	/**
+	 * \brief Queue bytes which are already encoded, they are only written to the file.
+	 * \param path File name.
+	 * \param encoded Content of the file.
+	 * \return False if the data was dropped or the writer is closed.
+	 */
+	bool writeEncoded(const std::string& path, std::vector<uchar> encoded)
+	{
+		Job job;
+		job.path = path;
+		job.bytes = encoded.size();
+		job.encoded = std::move(encoded);
+
+		return enqueue(std::move(job));
+	}
+
+	/**
+	 * \brief Wait until all queued images are written.
+	 */
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		idle_.wait(lock, [this] { return queue_.empty() and inFlight_ == 0; });
+	}
+
+	/**
+	 * \brief Write everything which is queued and stop the encoder threads. Later writes are rejected.
+	 */
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			if (closed_)
+				return;
+			closed_ = true;
+		}
+		jobAvailable_.notify_all();
+		spaceAvailable_.notify_all();
+
+		for (auto& worker : workers_)
+			worker.join();
+		workers_.clear();
+	}
+
+	AsyncWriterStats stats() const
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		return stats_;
+	}
+
+private:
+	struct Job
+	{
+		std::string path;
+		std::vector<int> params;
+		cv::Mat pixels;            // empty if encoded is used
+		std::vector<uchar> encoded;
+		size_t bytes{ 0 };
+	};
+
+	bool fits(size_t bytes) const
+	{
+		// A single image bigger than the limit is still accepted into an empty queue
+		return queue_.empty() or (queue_.size() < settings_.maxQueuedImages and queuedBytes_ + bytes <= settings_.maxQueuedBytes);
+	}
+
+	static std::vector<int> degradedParams(const std::vector<int>& params, int jpegQuality, int pngCompression)
+	{
+		std::vector<int> result;
+		for (size_t i{ 0 }; i + 1 < params.size(); i += 2)
+			if (params[i] != cv::IMWRITE_JPEG_QUALITY and params[i] != cv::IMWRITE_PNG_COMPRESSION)
+				result.insert(result.end(), { params[i], params[i + 1] });
+
+		result.insert(result.end(), { cv::IMWRITE_JPEG_QUALITY, jpegQuality, cv::IMWRITE_PNG_COMPRESSION, pngCompression });
+		return result;
+	}
+
+	bool enqueue(Job job)
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		if (closed_)
+			return false;
+
+		++stats_.submitted;
+
+		if (!fits(job.bytes))
+		{
+			switch (settings_.backPressure)
+			{
+			case BackPressure::DropNewest:
+				++stats_.dropped;
+				return false;
+
+			case BackPressure::DropOldest:
+				while (!queue_.empty() and !fits(job.bytes))
+				{
+					queuedBytes_ -= queue_.front().bytes;
+					queue_.pop_front();
+					++stats_.dropped;
+				}
+				break;
+
+			case BackPressure::Degrade:
+				if (!job.pixels.empty())
+				{
+					// Resizing and encoding parameters are cheap compared with waiting
+					lock.unlock();
+					cv::resize(job.pixels, job.pixels, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+					job.bytes = job.pixels.total() * job.pixels.elemSize();
+					job.params = degradedParams(job.params, settings_.degradedJpegQuality, settings_.degradedPngCompression);
+					lock.lock();
+					++stats_.degraded;
+				}
+				[[fallthrough]];
+
+			case BackPressure::Block:
+			{
+				auto start{ std::chrono::steady_clock::now() };
+				spaceAvailable_.wait(lock, [&] { return closed_ or fits(job.bytes); });
+				stats_.blockedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+				if (closed_)
+					return false;
+				break;
+			}
+			}
+		}
+
+		queuedBytes_ += job.bytes;
+		stats_.peakQueuedBytes = std::max(stats_.peakQueuedBytes, queuedBytes_);
+		queue_.push_back(std::move(job));
+
+		lock.unlock();
+		jobAvailable_.notify_one();
+		return true;
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock{ mutex_ };
+				jobAvailable_.wait(lock, [this] { return closed_ or !queue_.empty(); });
+
+				// After close the queue is still written completely
+				if (queue_.empty())
+					return;
+
+				job = std::move(queue_.front());
+				queue_.pop_front();
+				queuedBytes_ -= job.bytes;
+				++inFlight_;
+			}
+			spaceAvailable_.notify_all();
+
+			// Encode
+			auto start{ std::chrono::steady_clock::now() };
+			bool ok{ true };
+			if (!job.pixels.empty())
+			{
+				const std::string extension{ std::filesystem::path(job.path).extension().string() };
+				try
+				{
+					ok = cv::imencode(extension, job.pixels, job.encoded, job.params);
+				}
+				catch (const cv::Exception&)
+				{
+					ok = false;
+				}
+			}
+			double encodeMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+			// Write
+			start = std::chrono::steady_clock::now();
+			if (ok)
+			{
+				std::ofstream file{ job.path, std::ios::binary };
+				file.write(reinterpret_cast<const char*>(job.encoded.data()), static_cast<std::streamsize>(job.encoded.size()));
+				ok = static_cast<bool>(file);
+			}
+			double writeMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+			{
+				std::lock_guard<std::mutex> lock{ mutex_ };
+				stats_.encodeMs += encodeMs;
+				stats_.writeMs += writeMs;
+				if (ok)
+					++stats_.written;
+				else
+					++stats_.failed;
+				--inFlight_;
+			}
+			idle_.notify_all();
+		}
+	}
+
+	AsyncWriterSettings settings_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable jobAvailable_;   // for encoder threads
+	std::condition_variable spaceAvailable_; // for write() when blocked
+	std::condition_variable idle_;           // for flush()
+	std::deque<Job> queue_;
+	size_t queuedBytes_{ 0 };
+	int inFlight_{ 0 };
+	bool closed_{ false };
+	AsyncWriterStats stats_;
+
+	std::vector<std::thread> workers_;
+};
+
+/**
+ * \brief Stand-in for per frame processing: blur and a few drawings, about as heavy as a simple lesson.
+ */
+void processFrame(const cv::Mat& input, cv::Mat& output, int index)
+{
+	cv::GaussianBlur(input, output, cv::Size(5, 5), 0);
+	cv::circle(output, cv::Point(100 + (index * 13) % (output.cols - 200), output.rows / 2), 80, cv::Scalar(0, 255, 0), 3, cv::LINE_AA);
+	cv::putText(output, "frame " + std::to_string(index), cv::Point(30, 60), cv::FONT_HERSHEY_SIMPLEX, 1.5, cv::Scalar(255, 255, 255), 2);
+}
+
+BackPressure parseBackPressure(const std::string& name)
+{
+	if (name == "drop-newest")
+		return BackPressure::DropNewest;
+	if (name == "drop-oldest")
+		return BackPressure::DropOldest;
+	if (name == "degrade")
+		return BackPressure::Degrade;
+	return BackPressure::Block;
+}
+
+
+int main(int argc, char** argv)
+{
+	const int frames{ 60 };
+	const std::string directory{ "frames" };
+	std::filesystem::create_directories(directory);
+
+	// Random content, fixed seed (noise is hard to compress, so this is the worst case for PNG)
+	cv::Mat input(cv::Size(1920, 1080), CV_8UC3);
+	cv::setRNGSeed(42);
+	cv::randu(input, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	cv::Mat frame;
+
+	// Synchronous cv::imwrite
+	auto start{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < frames; ++i)
+	{
+		processFrame(input, frame, i);
+		cv::imwrite(directory + "/sync_" + std::to_string(i) + ".png", frame);
+	}
+	double syncMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	// AsyncImageWriter
+	AsyncWriterSettings settings;
+	settings.encoderThreads = std::max(1, cv::getNumberOfCPUs() - 1);
+	settings.backPressure = parseBackPressure(argc > 1 ? argv[1] : "block");
+
+	AsyncImageWriter writer(settings);
+
+	start = std::chrono::steady_clock::now();
+	for (int i{ 0 }; i < frames; ++i)
+	{
+		processFrame(input, frame, i);
+		writer.write(directory + "/async_" + std::to_string(i) + ".png", frame);
+	}
+	double loopMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	writer.flush();
+	double asyncMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	AsyncWriterStats stats{ writer.stats() };
+
+	std::cout << "Frames: " << frames << std::endl;
+	std::cout << "cv::imwrite: " << syncMs << " ms (" << frames * 1000.0 / syncMs << " fps)" << std::endl;
+	std::cout << "AsyncImageWriter: processing loop " << loopMs << " ms (" << frames * 1000.0 / loopMs << " fps), "
+		<< "until everything was on disk " << asyncMs << " ms" << std::endl;
+	std::cout << "Written: " << stats.written << ", dropped: " << stats.dropped << ", degraded: " << stats.degraded
+		<< ", failed: " << stats.failed << std::endl;
+	std::cout << "Peak queue memory: " << stats.peakQueuedBytes / (1 << 20) << " MB, encode: " << stats.encodeMs
+		<< " ms, write: " << stats.writeMs << " ms, producer blocked: " << stats.blockedMs << " ms" << std::endl;
+
+	writer.close();
+
+	return 0;
+}
@@ -0,0 +1,527 @@
+/*
+ * Memory-mapped image cache
+ * Every lesson starts with cv::imread and pays for a JPEG/PNG decode, and the tuning loops of the course decode the
+ * same files again and again. Decoding a Full HD JPEG takes 10-20 ms, while reading the same pixels from a file which
+ * is already in the OS page cache is almost free.
+ *
+ * MappedImageCache decodes every image only once:
+ *	- on the first load the image is decoded with cv::imread and the raw pixels are stored in a cache file: a header
+ *	  of one page (magic, size, type, step, source path, mtime and imread flags) followed by the rows,
+ *	- the cache file name is a hash of the source path, its modification time and the imread flags, so editing the
+ *	  source image or loading it with other flags never returns stale pixels. The header repeats the key, a hash
+ *	  collision is detected and treated as a miss,
+ *	- later loads map the cache file into memory and return a cv::Mat which points directly into the mapping, nothing
+ *	  is copied or decoded. The data offset is page aligned, so the Mat data is aligned as well,
+ *	- every imread() maps the file again and the mapping is private (copy-on-write): a lesson which draws into the
+ *	  returned image only copies the pages it touches, never modifies the cache file and never changes what later
+ *	  imread() calls return. Untouched pages are shared through the OS page cache, so mapping the same file several
+ *	  times costs no memory,
+ *	- the returned Mat owns its mapping through a cv::MatAllocator (MappingAllocator): the file is unmapped together
+ *	  with the last Mat (copy or ROI) which refers to it, exactly like memory from cv::Mat::create(). Loading the
+ *	  same image again and again in a tuning loop does not pile up mappings.
+ *
+ * The cache can be used from several threads, the statistics are guarded by a mutex.
+ *
+ * Cache files are written to a temporary file and renamed, so a crash or a second process never sees half of a file.
+ * The temporary name contains the process and the thread id, writers never share a temporary file.
+ *
+ * The program loads the images of the course data set with cv::imread, then through the cache (first run decodes and
+ * writes the cache, second run maps) and prints the time per image.
+ *
+ * Usage:
+ *	Source [image directory] [cache directory]
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * Read-only file mapped into memory as private (copy-on-write) pages.
+ */
+class FileMapping
+{
+public:
+	FileMapping() = default;
+
+	~FileMapping()
+	{
+		unmap();
+	}
+
+	FileMapping(const FileMapping&) = delete;
+	FileMapping& operator=(const FileMapping&) = delete;
+
+	/**
+	 * \brief Map the whole file.
+	 * \param path File name.
+	 * \return False if the file cannot be opened or mapped.
+	 */
+	bool map(const std::string& path)
+	{
+		unmap();
+
+#ifdef _WIN32
+		HANDLE file{ CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) or fileSize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping{ CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) };
+		CloseHandle(file);
+		if (mapping == nullptr)
+			return false;
+
+		data_ = static_cast<uchar*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+		CloseHandle(mapping);
+		if (data_ == nullptr)
+			return false;
+
+		size_ = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int file{ ::open(path.c_str(), O_RDONLY) };
+		if (file < 0)
+			return false;
+
+		struct stat info;
+		if (::fstat(file, &info) != 0 or info.st_size == 0)
+		{
+			::close(file);
+			return false;
+		}
+
+		void* data{ ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) };
+		::close(file);
+		if (data == MAP_FAILED)
+			return false;
+
+		data_ = static_cast<uchar*>(data);
+		size_ = static_cast<size_t>(info.st_size);
+#endif
+		return true;
+	}
+
+	void unmap()
+	{
+		if (data_ == nullptr)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+#else
+		::munmap(data_, size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	uchar* data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+	uchar* data_{ nullptr };
+	size_t size_{ 0 };
+};
+
+/**
+ * Allocator of the Mats returned by MappedImageCache, the UMatData owns the FileMapping and deallocate() unmaps it.
+ * New buffers (eg. create() with another size) come from the standard allocator.
+ */
+class MappingAllocator : public cv::MatAllocator
+{
+public:
+	static MappingAllocator& instance()
+	{
+		static MappingAllocator allocator;
+		return allocator;
+	}
+
+	/**
+	 * \brief Wrap a part of a mapping into a Mat which owns the mapping.
+	 * \param mapping Mapped file, released when the last Mat referring to it is released.
+	 * \param offset Offset of the first row in the mapping.
+	 * \param step Row step in bytes.
+	 */
+	cv::Mat wrap(std::unique_ptr<FileMapping> mapping, int rows, int cols, int type, size_t offset, size_t step) const
+	{
+		uchar* data{ mapping->data() + offset };
+		cv::Mat image(rows, cols, type, data, step);
+
+		cv::UMatData* u{ new cv::UMatData(this) };
+		u->data = u->origdata = data;
+		u->size = step * static_cast<size_t>(rows);
+		u->userdata = mapping.release();
+
+		image.u = u;
+		image.addref();
+		return image;
+	}
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+	{
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+	{
+		return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData* u) const override
+	{
+		if (u == nullptr)
+			return;
+
+		CV_Assert(u->urefcount == 0 and u->refcount == 0);
+		delete static_cast<FileMapping*>(u->userdata);
+		delete u;
+	}
+
+private:
+	MappingAllocator() = default;
+};
+
+struct ImageCacheStats
+{
+	size_t hits{ 0 };
+	size_t misses{ 0 };
+	size_t failed{ 0 };
+	double decodeMs{ 0 }; // cv::imread on misses
+	double storeMs{ 0 };  // writing cache files
+	double mapMs{ 0 };    // mapping cache files
+};
+
+/**
+ * Decodes images once into raw cache files and returns later loads as zero-copy views of the mapped files.
+ */
+class MappedImageCache
+{
+public:
+	/**
+	 * \brief Create the cache.
+	 * \param directory Directory for the cache files, created if it does not exist.
+	 */
+	explicit MappedImageCache(const std::string& directory)
+		: directory_(directory)
+	{
+		std::filesystem::create_directories(directory_);
+	}
+
+	/**
+	 * \brief Load an image, same arguments as cv::imread.
+	 * \param path Image file.
+	 * \param flags cv::ImreadModes.
+	 * \return Image pointing into its own private mapping of the cache file, unmapped with the last copy of the Mat.
+	 * Empty if the image cannot be read.
+	 */
+	cv::Mat imread(const std::string& path, int flags = cv::IMREAD_COLOR)
+	{
+		std::error_code error;
+		const std::string source{ std::filesystem::absolute(path, error).lexically_normal().string() };
+		const auto writeTime{ std::filesystem::last_write_time(source, error) };
+		if (error)
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			++stats_.failed;
+			return cv::Mat();
+		}
+
+		Key key{ source, static_cast<int64_t>(writeTime.time_since_epoch().count()), flags };
+		const std::string cacheFile{ cachePath(key) };
+
+		// Cache file from an earlier call or run. Mapped again every time, so writes of one caller into its image are
+		// never seen by the next one
+		cv::Mat image{ mapImage(cacheFile, key) };
+		if (!image.empty())
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			++stats_.hits;
+			return image;
+		}
+
+		// Miss: decode, store and map the stored file, so hits and misses return the same kind of Mat. Decoding and
+		// storing run without the lock, other threads can load other images meanwhile
+		auto start{ std::chrono::steady_clock::now() };
+		cv::Mat decoded{ cv::imread(source, flags) };
+		const double decodeMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			++stats_.misses;
+			stats_.decodeMs += decodeMs;
+			if (decoded.empty())
+			{
+				++stats_.failed;
+				return cv::Mat();
+			}
+		}
+
+		start = std::chrono::steady_clock::now();
+		bool stored{ store(cacheFile, key, decoded) };
+		const double storeMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			stats_.storeMs += storeMs;
+		}
+
+		if (stored)
+		{
+			image = mapImage(cacheFile, key);
+			if (!image.empty())
+				return image;
+		}
+
+		// The cache directory is not writable, the decoded image is still valid
+		return decoded;
+	}
+
+	ImageCacheStats stats() const
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		return stats_;
+	}
+
+private:
+	static constexpr uint64_t MAGIC{ 0x474D49574152564Cull }; // "LVRAWIMG"
+	static constexpr uint32_t VERSION{ 1 };
+	static constexpr size_t HEADER_SIZE{ 4096 };
+	static constexpr size_t MAX_PATH_LENGTH{ HEADER_SIZE - 64 };
+
+	struct Key
+	{
+		std::string source;
+		int64_t writeTime;
+		int flags;
+	};
+
+	// Fixed size part of the header, the source path follows it, the pixels start at dataOffset
+	struct Header
+	{
+		uint64_t magic;
+		uint32_t version;
+		int32_t rows;
+		int32_t cols;
+		int32_t type;
+		uint64_t step;
+		uint64_t dataOffset;
+		int64_t writeTime;
+		int32_t flags;
+		uint32_t pathLength;
+	};
+	static_assert(sizeof(Header) + MAX_PATH_LENGTH <= HEADER_SIZE, "Header does not fit into a page");
+
+	std::string cachePath(const Key& key) const
+	{
+		std::ostringstream name;
+		name << key.source << '|' << key.writeTime << '|' << key.flags;
+
+		std::ostringstream file;
+		file << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(name.str()) << ".raw";
+
+		return (std::filesystem::path(directory_) / file.str()).string();
+	}
+
+	static size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static unsigned long processId()
+	{
+#ifdef _WIN32
+		return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+		return static_cast<unsigned long>(::getpid());
+#endif
+	}
+
+	bool store(const std::string& cacheFile, const Key& key, const cv::Mat& image) const
+	{
+		if (key.source.size() > MAX_PATH_LENGTH)
+			return false;
+
+		Header header{};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.rows = image.rows;
+		header.cols = image.cols;
+		header.type = image.type();
+		header.step = alignUp(image.cols * image.elemSize(), 64); // every row starts on a cache line
+		header.dataOffset = HEADER_SIZE;
+		header.writeTime = key.writeTime;
+		header.flags = key.flags;
+		header.pathLength = static_cast<uint32_t>(key.source.size());
+
+		std::vector<char> page(HEADER_SIZE, 0);
+		std::memcpy(page.data(), &header, sizeof(header));
+		std::memcpy(page.data() + sizeof(header), key.source.data(), key.source.size());
+
+		// Temporary name first, rename is atomic, readers see either no file or a complete one. The name is unique per
+		// process and thread, so two writers never interleave their bytes in one temporary file.
+		const std::string temporary{ cacheFile + ".tmp" + std::to_string(processId()) + "."
+			+ std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) };
+		{
+			std::ofstream file{ temporary, std::ios::binary };
+			file.write(page.data(), static_cast<std::streamsize>(page.size()));
+
+			const size_t rowBytes{ image.cols * image.elemSize() };
+			std::vector<char> padding(header.step - rowBytes, 0);
+			for (int y{ 0 }; y < image.rows; ++y)
+			{
+				file.write(reinterpret_cast<const char*>(image.ptr(y)), static_cast<std::streamsize>(rowBytes));
+				file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+			}
+
+			if (!file)
+			{
+				file.close();
+				std::filesystem::remove(temporary);
+				return false;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporary, cacheFile, error);
+		if (error)
+		{
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		return true;
+	}
+
+	cv::Mat mapImage(const std::string& cacheFile, const Key& key)
+	{
+		auto start{ std::chrono::steady_clock::now() };
+
+		auto mapping{ std::make_unique<FileMapping>() };
+		if (!mapping->map(cacheFile) or mapping->size() < HEADER_SIZE)
+			return cv::Mat();
+
+		Header header;
+		std::memcpy(&header, mapping->data(), sizeof(header));
+
+		// Validate everything, the file may come from another version or be a hash collision
+		const char* path{ reinterpret_cast<const char*>(mapping->data()) + sizeof(header) };
+		if (header.magic != MAGIC or header.version != VERSION or header.pathLength > MAX_PATH_LENGTH
+			or header.writeTime != key.writeTime or header.flags != key.flags
+			or std::string(path, header.pathLength) != key.source
+			or header.rows <= 0 or header.cols <= 0 or header.dataOffset % HEADER_SIZE != 0
+			or header.step < header.cols * static_cast<uint64_t>(CV_ELEM_SIZE(header.type))
+			or header.dataOffset + header.step * header.rows > mapping->size())
+			return cv::Mat();
+
+		cv::Mat image{ MappingAllocator::instance().wrap(std::move(mapping), header.rows, header.cols, header.type,
+			static_cast<size_t>(header.dataOffset), static_cast<size_t>(header.step)) };
+		const double mapMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		stats_.mapMs += mapMs;
+		return image;
+	}
+
+	std::string directory_;
+
+	mutable std::mutex mutex_;
+	ImageCacheStats stats_;
+};
+
+
+int main(int argc, char** argv)
+{
+	const std::string imageDirectory{ argc > 1 ? argv[1] : "../../01_getting_started/data/images" };
+	const std::string cacheDirectory{ argc > 2 ? argv[2] : "image_cache" };
+
+	std::vector<cv::String> files;
+	for (const std::string pattern : { "/*.jpg", "/*.png" })
+	{
+		std::vector<cv::String> found;
+		cv::glob(imageDirectory + pattern, found, false);
+		files.insert(files.end(), found.begin(), found.end());
+	}
+
+	if (files.empty())
+	{
+		std::cout << "No images in " << imageDirectory << std::endl;
+		return 1;
+	}
+
+	// Reference: decode every time
+	auto start{ std::chrono::steady_clock::now() };
+	std::vector<cv::Mat> reference;
+	for (const auto& file : files)
+		reference.push_back(cv::imread(file));
+	double imreadMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	// First run of the cache: cache files from an earlier start are hits already
+	MappedImageCache firstCache(cacheDirectory);
+	start = std::chrono::steady_clock::now();
+	for (const auto& file : files)
+		firstCache.imread(file);
+	double firstMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+	ImageCacheStats firstStats{ firstCache.stats() };
+
+	// New cache object, like the next run of a program: everything is mapped
+	MappedImageCache cache(cacheDirectory);
+	start = std::chrono::steady_clock::now();
+	std::vector<cv::Mat> cached;
+	for (const auto& file : files)
+		cached.push_back(cache.imread(file));
+	double secondMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	int mismatches{ 0 };
+	for (size_t i{ 0 }; i < files.size(); ++i)
+		if (reference[i].size() != cached[i].size() or cv::norm(reference[i], cached[i], cv::NORM_INF) != 0)
+			++mismatches;
+
+	const double count{ static_cast<double>(files.size()) };
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Images: " << files.size() << ", mismatches: " << mismatches << std::endl;
+	std::cout << std::left << std::setw(24) << "" << std::right << std::setw(12) << "total ms" << std::setw(14) << "ms / image" << std::endl;
+	std::cout << std::left << std::setw(24) << "cv::imread" << std::right << std::setw(12) << imreadMs << std::setw(14) << imreadMs / count << std::endl;
+	std::cout << std::left << std::setw(24) << "cache, first run" << std::right << std::setw(12) << firstMs << std::setw(14) << firstMs / count << std::endl;
+	std::cout << std::left << std::setw(24) << "cache, second run" << std::right << std::setw(12) << secondMs << std::setw(14) << secondMs / count << std::endl;
+	std::cout << "First run: " << firstStats.misses << " misses (decode " << firstStats.decodeMs << " ms, store "
+		<< firstStats.storeMs << " ms), " << firstStats.hits << " hits" << std::endl;
+	std::cout << "Second run: " << cache.stats().hits << " hits, map " << cache.stats().mapMs << " ms" << std::endl;
+
+	return 0;
+}
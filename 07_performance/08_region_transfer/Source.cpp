@@ -0,0 +1,437 @@
+/*
+ * Batched region transfer
+ * 03_manipulating_group_of_pixels, 11_crop_the_image and 12_copying_a_region_to_another copy one region at a time:
+ *	src(cv::Range(...), cv::Range(...)).copyTo(dst(cv::Range(...), cv::Range(...)));
+ * For a few regions that is perfect. A mosaic or a patch transfer moves tens of thousands of small regions per image and
+ * then the cost is not the copying: every call creates two Mat headers, checks the arguments and possibly reallocates,
+ * and the regions are visited in random order, so the source and the destination rows are evicted from the cache again
+ * and again.
+ *
+ * RegionTransfer collects the moves first and executes them all at once:
+ *	- copy(), copyMasked() and blend() only record a move (source rectangle, destination position, mask or alpha),
+ *	- apply() clips the moves to both images and splits the destination into bands of a few rows (about 64 kB each).
+ *	  Every move is put into the lists of the bands it touches,
+ *	- bands are processed in parallel with cv::parallel_for_, one band always by one thread, so two threads never write
+ *	  the same pixel,
+ *	- inside a band the moves are executed in the order they were added if their destinations overlap (the last one
+ *	  wins, same as the copyTo loop). If they do not overlap, the order does not matter and the moves are sorted by
+ *	  their source position, so neighbouring moves read neighbouring source rows,
+ *	- rows are copied with memcpy, masked copies and alpha blending use SIMD.
+ *
+ * Source and destination may be the same image (like 12_copying_a_region_to_another), the source is then copied once
+ * before the moves, so every move reads the original pixels.
+ *
+ * The program moves random patches with the copyTo loop and with RegionTransfer and compares times and results.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+
+/**
+ * \brief Exact division by 255 with rounding for x in [0, 255 * 255].
+ */
+inline int div255(int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+#if CV_SIMD128
+inline cv::v_uint16x8 div255(const cv::v_uint16x8& x)
+{
+	cv::v_uint16x8 t{ cv::v_add_wrap(x, cv::v_setall_u16(128)) };
+	return cv::v_shr<8>(cv::v_add_wrap(t, cv::v_shr<8>(t)));
+}
+#endif
+
+/**
+ * \brief Repeat every mask value for all bytes of its pixel, so the kernels below work on bytes of any pixel type.
+ * \param mask Mask row, one value per pixel.
+ * \param width Number of pixels.
+ * \param pixelBytes Bytes per pixel.
+ * \param out Output, width * pixelBytes values.
+ */
+void expandMask(const uchar* mask, int width, int pixelBytes, uchar* out)
+{
+	if (pixelBytes == 1)
+	{
+		std::memcpy(out, mask, width);
+		return;
+	}
+
+	for (int x{ 0 }; x < width; ++x, out += pixelBytes)
+		std::memset(out, mask[x], pixelBytes);
+}
+
+/**
+ * \brief Copy the bytes whose mask is not zero.
+ */
+void maskedCopyRow(uchar* dst, const uchar* src, const uchar* mask, int n)
+{
+	int i{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint8x16 zero{ cv::v_setzero_u8() };
+	for (; i <= n - 16; i += 16)
+	{
+		cv::v_uint8x16 m{ cv::v_load(mask + i) };
+		cv::v_store(dst + i, cv::v_select(m != zero, cv::v_load(src + i), cv::v_load(dst + i)));
+	}
+#endif
+
+	for (; i < n; ++i)
+		if (mask[i])
+			dst[i] = src[i];
+}
+
+/**
+ * \brief dst = (src * alpha + dst * (255 - alpha)) / 255 for every byte.
+ */
+void blendRow(uchar* dst, const uchar* src, const uchar* alpha, int n)
+{
+	int i{ 0 };
+
+#if CV_SIMD128
+	const cv::v_uint8x16 maxAlpha{ cv::v_setall_u8(255) };
+	for (; i <= n - 16; i += 16)
+	{
+		cv::v_uint8x16 a{ cv::v_load(alpha + i) };
+		cv::v_uint16x8 low0, high0, low1, high1;
+		cv::v_mul_expand(cv::v_load(src + i), a, low0, high0);
+		cv::v_mul_expand(cv::v_load(dst + i), maxAlpha - a, low1, high1);
+		cv::v_store(dst + i, cv::v_pack(div255(cv::v_add_wrap(low0, low1)), div255(cv::v_add_wrap(high0, high1))));
+	}
+#endif
+
+	for (; i < n; ++i)
+		dst[i] = static_cast<uchar>(div255(src[i] * alpha[i] + dst[i] * (255 - alpha[i])));
+}
+
+/**
+ * Records region moves and executes them in one batch.
+ */
+class RegionTransfer
+{
+public:
+	/**
+	 * \brief Copy src(rect) to dst at position to.
+	 */
+	void copy(const cv::Rect& rect, const cv::Point& to)
+	{
+		moves_.push_back(Move{ rect, to, Move::Copy, cv::Mat(), 255 });
+	}
+
+	/**
+	 * \brief Copy the pixels of src(rect) whose mask is not zero.
+	 * \param mask CV_8UC1 of the size of rect. Only the header is stored, the mask must stay valid until apply().
+	 */
+	void copyMasked(const cv::Rect& rect, const cv::Point& to, const cv::Mat& mask)
+	{
+		CV_Assert(mask.type() == CV_8UC1 and mask.size() == rect.size());
+		moves_.push_back(Move{ rect, to, Move::Masked, mask, 255 });
+	}
+
+	/**
+	 * \brief Blend src(rect) over dst with per pixel alpha (only CV_8U images).
+	 * \param alpha CV_8UC1 of the size of rect, 255 = source only. Only the header is stored.
+	 */
+	void blend(const cv::Rect& rect, const cv::Point& to, const cv::Mat& alpha)
+	{
+		CV_Assert(alpha.type() == CV_8UC1 and alpha.size() == rect.size());
+		moves_.push_back(Move{ rect, to, Move::Blend, alpha, 255 });
+	}
+
+	/**
+	 * \brief Blend src(rect) over dst with constant opacity (only CV_8U images).
+	 * \param opacity 0 - 1.
+	 */
+	void blend(const cv::Rect& rect, const cv::Point& to, double opacity)
+	{
+		const int alpha{ cv::saturate_cast<int>(std::clamp(opacity, 0.0, 1.0) * 255) };
+		moves_.push_back(Move{ rect, to, Move::Blend, cv::Mat(), alpha });
+	}
+
+	size_t size() const
+	{
+		return moves_.size();
+	}
+
+	void clear()
+	{
+		moves_.clear();
+	}
+
+	/**
+	 * \brief Execute all recorded moves. Moves are clipped to both images.
+	 * \param src Source image.
+	 * \param dst Destination image of the same type, may be src itself.
+	 */
+	void apply(const cv::Mat& src, cv::Mat& dst) const
+	{
+		CV_Assert(src.type() == dst.type() and !dst.empty());
+
+		// Moves within one image read the original pixels
+		cv::Mat source{ src };
+		if (src.datastart < dst.dataend and dst.datastart < src.dataend)
+			source = src.clone();
+
+		const int pixelBytes{ static_cast<int>(dst.elemSize()) };
+		const cv::Rect srcBounds{ 0, 0, source.cols, source.rows };
+		const cv::Rect dstBounds{ 0, 0, dst.cols, dst.rows };
+
+		// Clip: the part of the move inside both images
+		std::vector<Clipped> clipped;
+		clipped.reserve(moves_.size());
+		for (const Move& move : moves_)
+		{
+			CV_Assert(move.kind != Move::Blend or dst.depth() == CV_8U);
+
+			const cv::Point shift{ move.to - move.rect.tl() };
+			cv::Rect from{ move.rect & srcBounds };
+			from &= (dstBounds - shift);
+			if (from.empty())
+				continue;
+
+			clipped.push_back(Clipped{ from, from + shift, from.tl() - move.rect.tl(), &move });
+		}
+
+		// Bands of about 64 kB of the destination
+		const int bandRows{ std::clamp(static_cast<int>(65536 / dst.step[0]), 4, 256) };
+		const int bands{ (dst.rows + bandRows - 1) / bandRows };
+
+		std::vector<std::vector<int>> bandMoves(bands);
+		for (int i{ 0 }; i < static_cast<int>(clipped.size()); ++i)
+		{
+			const cv::Rect& to{ clipped[i].to };
+			for (int b{ to.y / bandRows }; b <= (to.br().y - 1) / bandRows; ++b)
+				bandMoves[b].push_back(i);
+		}
+
+		cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range)
+			{
+				std::vector<uchar> maskBuffer;
+				std::vector<int> order;
+
+				for (int b{ range.start }; b < range.end; ++b)
+				{
+					order = bandMoves[b];
+					if (order.empty())
+						continue;
+
+					if (!destinationsOverlap(clipped, order))
+						std::sort(order.begin(), order.end(), [&](int i, int j)
+							{
+								const cv::Point& a{ clipped[i].from.tl() };
+								const cv::Point& c{ clipped[j].from.tl() };
+								return a.y < c.y or (a.y == c.y and a.x < c.x);
+							});
+
+					const int bandStart{ b * bandRows };
+					const int bandEnd{ std::min(bandStart + bandRows, dst.rows) };
+
+					for (int i : order)
+					{
+						const Clipped& c{ clipped[i] };
+						const int y0{ std::max(c.to.y, bandStart) };
+						const int y1{ std::min(c.to.br().y, bandEnd) };
+						const int rowBytes{ c.to.width * pixelBytes };
+						if (c.move->kind != Move::Copy)
+							maskBuffer.resize(rowBytes);
+
+						for (int y{ y0 }; y < y1; ++y)
+						{
+							const int sy{ y - c.to.y + c.from.y };
+							uchar* d{ dst.ptr<uchar>(y) + c.to.x * pixelBytes };
+							const uchar* s{ source.ptr<uchar>(sy) + c.from.x * pixelBytes };
+
+							if (c.move->kind == Move::Copy)
+							{
+								std::memcpy(d, s, rowBytes);
+								continue;
+							}
+
+							if (c.move->mask.empty())
+								std::memset(maskBuffer.data(), c.move->alpha, rowBytes);
+							else
+								expandMask(c.move->mask.ptr<uchar>(y - c.to.y + c.maskOffset.y) + c.maskOffset.x, c.to.width, pixelBytes, maskBuffer.data());
+
+							if (c.move->kind == Move::Masked)
+								maskedCopyRow(d, s, maskBuffer.data(), rowBytes);
+							else
+								blendRow(d, s, maskBuffer.data(), rowBytes);
+						}
+					}
+				}
+			}, bands);
+	}
+
+private:
+	struct Move
+	{
+		enum Kind
+		{
+			Copy,
+			Masked,
+			Blend,
+		};
+
+		cv::Rect rect;
+		cv::Point to;
+		Kind kind;
+		cv::Mat mask; // mask or per pixel alpha, empty for constant alpha
+		int alpha;    // constant alpha
+	};
+
+	struct Clipped
+	{
+		cv::Rect from;        // source pixels
+		cv::Rect to;          // destination pixels
+		cv::Point maskOffset; // of from inside the mask
+		const Move* move;
+	};
+
+	/**
+	 * \brief Check if any two destinations of a band overlap. Only columns are compared, so touching a band counts as
+	 * overlapping rows - the answer may be a false "yes", which only costs the sorting.
+	 */
+	static bool destinationsOverlap(const std::vector<Clipped>& clipped, const std::vector<int>& indices)
+	{
+		std::vector<std::pair<int, int>> columns;
+		columns.reserve(indices.size());
+		for (int i : indices)
+			columns.emplace_back(clipped[i].to.x, clipped[i].to.br().x);
+
+		std::sort(columns.begin(), columns.end());
+		for (size_t i{ 1 }; i < columns.size(); ++i)
+			if (columns[i].first < columns[i - 1].second)
+				return true;
+
+		return false;
+	}
+
+	std::vector<Move> moves_;
+};
+
+/**
+ * \brief The copyTo loop of the lessons, the reference for RegionTransfer.
+ */
+void referenceTransfer(const cv::Mat& src, cv::Mat& dst, const std::vector<cv::Rect>& rects, const std::vector<cv::Point>& positions,
+	const std::vector<const cv::Mat*>& masks)
+{
+	for (size_t i{ 0 }; i < rects.size(); ++i)
+	{
+		cv::Mat from{ src(rects[i]) };
+		cv::Mat to{ dst(cv::Rect(positions[i], rects[i].size())) };
+
+		if (masks.empty())
+			from.copyTo(to);
+		else
+			from.copyTo(to, *masks[i]);
+	}
+}
+
+
+int main()
+{
+	const int count{ 20000 };
+
+	cv::Mat src(cv::Size(1920, 1080), CV_8UC3);
+	cv::setRNGSeed(42);
+	cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	// Random patches 8x8 - 32x32, destinations inside the image (the copyTo loop does not clip)
+	cv::RNG rng(42);
+	std::vector<cv::Rect> rects;
+	std::vector<cv::Point> positions;
+	for (int i{ 0 }; i < count; ++i)
+	{
+		cv::Size size(rng.uniform(8, 33), rng.uniform(8, 33));
+		rects.emplace_back(rng.uniform(0, src.cols - size.width), rng.uniform(0, src.rows - size.height), size.width, size.height);
+		positions.emplace_back(rng.uniform(0, src.cols - size.width), rng.uniform(0, src.rows - size.height));
+	}
+
+	// Circular masks, one per patch size
+	std::vector<cv::Mat> maskPool(33 * 33);
+	std::vector<const cv::Mat*> masks;
+	for (const cv::Rect& rect : rects)
+	{
+		cv::Mat& mask{ maskPool[rect.height * 33 + rect.width] };
+		if (mask.empty())
+		{
+			mask = cv::Mat::zeros(rect.size(), CV_8UC1);
+			cv::ellipse(mask, cv::Point(rect.width / 2, rect.height / 2), cv::Size(rect.width / 2, rect.height / 2), 0, 0, 360, cv::Scalar(255), cv::FILLED);
+		}
+		masks.push_back(&mask);
+	}
+
+	auto timeMs = [](auto&& function)
+		{
+			auto start{ std::chrono::steady_clock::now() };
+			function();
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+	for (bool masked : { false, true })
+	{
+		cv::Mat expected{ cv::Mat::zeros(src.size(), src.type()) };
+		cv::Mat result{ cv::Mat::zeros(src.size(), src.type()) };
+
+		double referenceMs{ timeMs([&] { referenceTransfer(src, expected, rects, positions, masked ? masks : std::vector<const cv::Mat*>()); }) };
+
+		RegionTransfer transfer;
+		double transferMs{ timeMs([&]
+			{
+				for (int i{ 0 }; i < count; ++i)
+				{
+					if (masked)
+						transfer.copyMasked(rects[i], positions[i], *masks[i]);
+					else
+						transfer.copy(rects[i], positions[i]);
+				}
+				transfer.apply(src, result);
+			}) };
+
+		std::cout << (masked ? "Masked copy" : "Copy") << " of " << count << " regions: copyTo loop " << referenceMs
+			<< " ms, RegionTransfer " << transferMs << " ms, max difference " << cv::norm(expected, result, cv::NORM_INF) << std::endl;
+	}
+
+	// Blending within one image, like 12_copying_a_region_to_another: every region reads the pixels before the blend
+	{
+		const double opacity{ 128 / 255.0 }; // blend(0.5) stores the alpha as 128
+
+		cv::Mat expected{ src.clone() };
+		double referenceMs{ timeMs([&]
+			{
+				const cv::Mat original{ expected.clone() };
+				for (int i{ 0 }; i < count; ++i)
+				{
+					cv::Mat to{ expected(cv::Rect(positions[i], rects[i].size())) };
+					cv::addWeighted(original(rects[i]), opacity, to, 1 - opacity, 0, to);
+				}
+			}) };
+
+		cv::Mat result{ src.clone() };
+		RegionTransfer transfer;
+		double transferMs{ timeMs([&]
+			{
+				for (int i{ 0 }; i < count; ++i)
+					transfer.blend(rects[i], positions[i], 0.5);
+				transfer.apply(result, result);
+			}) };
+
+		// addWeighted rounds in float, the integer blend with div255, overlapping regions can differ by one or two
+		std::cout << "Blend of " << count << " regions within one image: addWeighted loop " << referenceMs
+			<< " ms, RegionTransfer " << transferMs << " ms, max difference " << cv::norm(expected, result, cv::NORM_INF) << std::endl;
+	}
+
+	return 0;
+}
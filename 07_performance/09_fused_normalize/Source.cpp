@@ -0,0 +1,397 @@
+/*
+ * Fused normalization
+ * 15_datatype_conversion, 16_more_on_conversion, the face blending, color space and connected component lessons all
+ * normalize an image the same way:
+ *	image.convertTo(imageFloat, CV_32F);
+ *	cv::normalize(imageFloat, imageFloat, 0, 255, cv::NORM_MINMAX);
+ *	imageFloat.convertTo(image, CV_8U);
+ * That is four passes over the image (conversion, min/max, scaling, conversion back) and two allocations of a float
+ * image, four times bigger than the 8-bit one. Only two passes are needed:
+ *	1. min and max of the source, in its own type (cv::minMaxIdx, no conversion),
+ *	2. one pass which converts to float, computes value * scale + shift, rounds, saturates and stores the
+ *	   destination type.
+ *
+ * convertScale() is the second pass alone (cv::Mat::convertTo into a preallocated destination), normalizeMinMax() does
+ * both. The conversion kernel is a template over the source and destination types: 16 values per iteration are
+ * loaded and widened to 4 float vectors, multiplied and added, then rounded and packed with saturation to the
+ * destination type. All pairs of 8U, 8S, 16U, 16S and 32F sources with 8U, 8S, 16U, 16S, 32S and 32F destinations
+ * use SIMD. Pairs with 32S or 64F sources or 64F destinations are computed in double (float has only 24 bits of
+ * mantissa), without SIMD. Rows are processed in parallel.
+ *
+ * With a mask the conversion pass converts only the runs of pixels under the mask (each run with the same SIMD kernel)
+ * and does not touch the rest of the destination, no converted temporary image and no copyTo(dst, mask) are needed.
+ *
+ * The destination is reallocated only if its size or type does not match, so a preallocated destination (or the
+ * result of the previous frame) is reused.
+ *
+ * The program compares the chain of the lessons with normalizeMinMax() for a few type combinations. The chain runs on
+ * one thread, so normalizeMinMax() is timed on one thread (the gain of fusing the passes) and with all threads.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+#if CV_SIMD128
+// Types with a SIMD load (source) and store (destination) below
+template<typename T>
+constexpr bool simdSource{ std::is_same_v<T, uchar> or std::is_same_v<T, schar> or std::is_same_v<T, ushort>
+	or std::is_same_v<T, short> or std::is_same_v<T, float> };
+
+template<typename T>
+constexpr bool simdDestination{ simdSource<T> or std::is_same_v<T, int> };
+
+/**
+ * \brief Load 16 values and convert them to float.
+ */
+inline void load16(const uchar* p, cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		v[k] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(cv::v_load_expand_q(p + 4 * k)));
+}
+
+inline void load16(const schar* p, cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		v[k] = cv::v_cvt_f32(cv::v_load_expand_q(p + 4 * k));
+}
+
+inline void load16(const ushort* p, cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		v[k] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(cv::v_load_expand(p + 4 * k)));
+}
+
+inline void load16(const short* p, cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		v[k] = cv::v_cvt_f32(cv::v_load_expand(p + 4 * k));
+}
+
+inline void load16(const float* p, cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		v[k] = cv::v_load(p + 4 * k);
+}
+
+/**
+ * \brief Round 16 floats and store them with saturation.
+ */
+inline void store16(uchar* p, const cv::v_float32x4 (&v)[4])
+{
+	cv::v_int16x8 low{ cv::v_pack(cv::v_round(v[0]), cv::v_round(v[1])) };
+	cv::v_int16x8 high{ cv::v_pack(cv::v_round(v[2]), cv::v_round(v[3])) };
+	cv::v_store(p, cv::v_pack_u(low, high));
+}
+
+inline void store16(schar* p, const cv::v_float32x4 (&v)[4])
+{
+	cv::v_int16x8 low{ cv::v_pack(cv::v_round(v[0]), cv::v_round(v[1])) };
+	cv::v_int16x8 high{ cv::v_pack(cv::v_round(v[2]), cv::v_round(v[3])) };
+	cv::v_store(p, cv::v_pack(low, high));
+}
+
+inline void store16(ushort* p, const cv::v_float32x4 (&v)[4])
+{
+	cv::v_store(p, cv::v_pack_u(cv::v_round(v[0]), cv::v_round(v[1])));
+	cv::v_store(p + 8, cv::v_pack_u(cv::v_round(v[2]), cv::v_round(v[3])));
+}
+
+inline void store16(short* p, const cv::v_float32x4 (&v)[4])
+{
+	cv::v_store(p, cv::v_pack(cv::v_round(v[0]), cv::v_round(v[1])));
+	cv::v_store(p + 8, cv::v_pack(cv::v_round(v[2]), cv::v_round(v[3])));
+}
+
+inline void store16(int* p, const cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		cv::v_store(p + 4 * k, cv::v_round(v[k]));
+}
+
+inline void store16(float* p, const cv::v_float32x4 (&v)[4])
+{
+	for (int k{ 0 }; k < 4; ++k)
+		cv::v_store(p + 4 * k, v[k]);
+}
+#endif
+
+/**
+ * \brief dst = saturate(src * scale + shift) for one row.
+ * \param src Source values.
+ * \param dst Destination values.
+ * \param n Number of values (pixels * channels).
+ * \param scale Scale.
+ * \param shift Added after scaling.
+ */
+template<typename S, typename D>
+void convertRow(const S* src, D* dst, int n, double scale, double shift)
+{
+	int i{ 0 };
+
+#if CV_SIMD128
+	if constexpr (simdSource<S> and simdDestination<D>)
+	{
+		const float scaleF{ static_cast<float>(scale) };
+		const float shiftF{ static_cast<float>(shift) };
+		const cv::v_float32x4 vScale{ cv::v_setall_f32(scaleF) };
+		const cv::v_float32x4 vShift{ cv::v_setall_f32(shiftF) };
+
+		for (; i <= n - 16; i += 16)
+		{
+			cv::v_float32x4 v[4];
+			load16(src + i, v);
+			for (int k{ 0 }; k < 4; ++k)
+				v[k] = cv::v_fma(v[k], vScale, vShift);
+			store16(dst + i, v);
+		}
+
+		// Tail in float as well, so every value is rounded the same way
+		for (; i < n; ++i)
+			dst[i] = cv::saturate_cast<D>(static_cast<float>(src[i]) * scaleF + shiftF);
+		return;
+	}
+#endif
+
+	for (; i < n; ++i)
+		dst[i] = cv::saturate_cast<D>(static_cast<double>(src[i]) * scale + shift);
+}
+
+using ConvertRowFunc = void (*)(const uchar*, uchar*, int, double, double);
+
+template<typename S, typename D>
+void convertRowBytes(const uchar* src, uchar* dst, int n, double scale, double shift)
+{
+	convertRow(reinterpret_cast<const S*>(src), reinterpret_cast<D*>(dst), n, scale, shift);
+}
+
+template<typename S>
+ConvertRowFunc convertRowFunc(int ddepth)
+{
+	switch (ddepth)
+	{
+	case CV_8U: return convertRowBytes<S, uchar>;
+	case CV_8S: return convertRowBytes<S, schar>;
+	case CV_16U: return convertRowBytes<S, ushort>;
+	case CV_16S: return convertRowBytes<S, short>;
+	case CV_32S: return convertRowBytes<S, int>;
+	case CV_32F: return convertRowBytes<S, float>;
+	case CV_64F: return convertRowBytes<S, double>;
+	default: return nullptr;
+	}
+}
+
+/**
+ * \brief Kernel for a pair of depths.
+ */
+ConvertRowFunc convertRowFunc(int sdepth, int ddepth)
+{
+	switch (sdepth)
+	{
+	case CV_8U: return convertRowFunc<uchar>(ddepth);
+	case CV_8S: return convertRowFunc<schar>(ddepth);
+	case CV_16U: return convertRowFunc<ushort>(ddepth);
+	case CV_16S: return convertRowFunc<short>(ddepth);
+	case CV_32S: return convertRowFunc<int>(ddepth);
+	case CV_32F: return convertRowFunc<float>(ddepth);
+	case CV_64F: return convertRowFunc<double>(ddepth);
+	default: return nullptr;
+	}
+}
+
+/**
+ * \brief Same as src.convertTo(dst, ddepth, scale, shift) in one parallel pass, dst is reused if it has the right size
+ * and type.
+ * \param src Source image, any number of channels.
+ * \param dst Destination image, pixels outside the mask are not changed.
+ * \param ddepth Destination depth, -1 for the depth of src.
+ * \param scale Scale.
+ * \param shift Added after scaling.
+ * \param mask Optional CV_8UC1 mask of the size of src, only pixels under the mask are converted.
+ */
+void convertScale(const cv::Mat& src, cv::Mat& dst, int ddepth, double scale = 1, double shift = 0, const cv::Mat& mask = cv::Mat())
+{
+	CV_Assert(mask.empty() or (mask.type() == CV_8UC1 and mask.size() == src.size()));
+
+	if (ddepth < 0)
+		ddepth = src.depth();
+
+	ConvertRowFunc convert{ convertRowFunc(src.depth(), ddepth) };
+	CV_Assert(convert != nullptr);
+
+	// In place only if the element size does not change
+	cv::Mat source{ src };
+	if (src.data == dst.data and src.elemSize1() != CV_ELEM_SIZE1(ddepth))
+		source = src.clone();
+
+	dst.create(source.size(), CV_MAKETYPE(ddepth, source.channels()));
+
+	// Continuous images are one long row, split into stripes of whole rows anyway to keep it simple
+	const int cn{ source.channels() };
+	const int values{ source.cols * cn };
+	const size_t srcPixelBytes{ source.elemSize() };
+	const size_t dstPixelBytes{ dst.elemSize() };
+	const double bytes{ static_cast<double>(source.total() * (srcPixelBytes + dstPixelBytes)) };
+
+	cv::parallel_for_(cv::Range(0, source.rows), [&](const cv::Range& range)
+		{
+			for (int y{ range.start }; y < range.end; ++y)
+			{
+				const uchar* s{ source.ptr<uchar>(y) };
+				uchar* d{ dst.ptr<uchar>(y) };
+				if (mask.empty())
+				{
+					convert(s, d, values, scale, shift);
+					continue;
+				}
+
+				// Runs of pixels under the mask, the pixels between them are skipped
+				const uchar* m{ mask.ptr<uchar>(y) };
+				for (int x{ 0 }; x < source.cols;)
+				{
+					while (x < source.cols and m[x] == 0)
+						++x;
+					const int start{ x };
+					while (x < source.cols and m[x] != 0)
+						++x;
+					if (x > start)
+						convert(s + start * srcPixelBytes, d + start * dstPixelBytes, (x - start) * cn, scale, shift);
+				}
+			}
+		}, std::max(1.0, bytes / 65536));
+}
+
+/**
+ * \brief Same as cv::normalize(src, dst, low, high, cv::NORM_MINMAX, ddepth, mask) with one pass for min/max and one
+ * for the conversion.
+ * \param src Source image, single channel if mask is used.
+ * \param dst Destination image, pixels outside the mask are not changed.
+ * \param low Value of the minimum.
+ * \param high Value of the maximum.
+ * \param ddepth Destination depth, -1 for the depth of src.
+ * \param mask Optional CV_8UC1 mask, min/max is computed only under the mask.
+ */
+void normalizeMinMax(const cv::Mat& src, cv::Mat& dst, double low, double high, int ddepth = -1, const cv::Mat& mask = cv::Mat())
+{
+	double minimum{ 0 };
+	double maximum{ 0 };
+	cv::minMaxIdx(src, &minimum, &maximum, nullptr, nullptr, mask);
+
+	// Same formula as cv::normalize, a flat image maps to low
+	const double range{ maximum - minimum };
+	const double scale{ (high - low) * (range > DBL_EPSILON ? 1.0 / range : 0.0) };
+	const double shift{ low - minimum * scale };
+
+	convertScale(src, dst, ddepth, scale, shift, mask);
+}
+
+/**
+ * \brief Median time of a function in milliseconds.
+ */
+template<typename Function>
+double medianMs(Function function, int repetitions = 15)
+{
+	function();
+
+	std::vector<double> times;
+	for (int i{ 0 }; i < repetitions; ++i)
+	{
+		auto start{ std::chrono::steady_clock::now() };
+		function();
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+	return times[times.size() / 2];
+}
+
+
+int main()
+{
+	struct Case
+	{
+		std::string name;
+		int srcType;
+		int ddepth;
+		double low;
+		double high;
+	};
+
+	const std::vector<Case> cases
+	{
+		{ "8UC3 -> 8U [0, 255]", CV_8UC3, CV_8U, 0, 255 },
+		{ "16UC1 -> 8U [0, 255]", CV_16UC1, CV_8U, 0, 255 },
+		{ "32FC1 -> 8U [0, 255]", CV_32FC1, CV_8U, 0, 255 },
+		{ "8UC3 -> 32F [0, 1]", CV_8UC3, CV_32F, 0, 1 },
+		{ "32SC1 -> 16U [0, 65535]", CV_32SC1, CV_16U, 0, 65535 },
+	};
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << std::left << std::setw(26) << "case" << std::right << std::setw(12) << "chain ms" << std::setw(14) << "fused 1T ms"
+		<< std::setw(10) << "speedup" << std::setw(14) << "fused MT ms" << std::setw(10) << "speedup" << std::setw(12) << "max diff"
+		<< std::endl;
+
+	for (const Case& c : cases)
+	{
+		// Values in the middle of the range, so the normalization really stretches them
+		cv::Mat src(cv::Size(1920, 1080), c.srcType);
+		cv::setRNGSeed(42);
+		cv::randu(src, cv::Scalar::all(10), cv::Scalar::all(100));
+
+		// The chain of the lessons
+		cv::Mat expected;
+		double chainMs{ medianMs([&]
+			{
+				cv::Mat srcFloat;
+				src.convertTo(srcFloat, CV_32F);
+				cv::normalize(srcFloat, srcFloat, c.low, c.high, cv::NORM_MINMAX);
+				srcFloat.convertTo(expected, c.ddepth);
+			}) };
+
+		// Fused, the destination is allocated once and reused
+		cv::Mat result;
+		cv::setNumThreads(1);
+		double serialMs{ medianMs([&] { normalizeMinMax(src, result, c.low, c.high, c.ddepth); }) };
+		cv::setNumThreads(-1);
+		double fusedMs{ medianMs([&] { normalizeMinMax(src, result, c.low, c.high, c.ddepth); }) };
+
+		cv::Mat difference;
+		cv::absdiff(expected, result, difference);
+		double maxDifference{ 0 };
+		cv::minMaxIdx(difference.reshape(1), nullptr, &maxDifference);
+
+		std::cout << std::left << std::setw(26) << c.name << std::right << std::setw(12) << chainMs << std::setw(14) << serialMs
+			<< std::setw(9) << chainMs / serialMs << "x" << std::setw(14) << fusedMs << std::setw(9) << chainMs / fusedMs << "x"
+			<< std::setw(12) << maxDifference << std::endl;
+	}
+
+	// Mask: min/max and conversion only inside a circle, the rest of the destination stays black
+	{
+		cv::Mat src(cv::Size(1920, 1080), CV_16UC1);
+		cv::setRNGSeed(42);
+		cv::randu(src, cv::Scalar::all(10), cv::Scalar::all(100));
+
+		cv::Mat mask{ cv::Mat::zeros(src.size(), CV_8UC1) };
+		cv::circle(mask, cv::Point(src.cols / 2, src.rows / 2), src.rows / 2, cv::Scalar(255), cv::FILLED);
+
+		cv::Mat expected{ cv::Mat::zeros(src.size(), CV_8UC1) };
+		double chainMs{ medianMs([&] { cv::normalize(src, expected, 0, 255, cv::NORM_MINMAX, CV_8U, mask); }) };
+
+		cv::Mat result{ cv::Mat::zeros(src.size(), CV_8UC1) };
+		double fusedMs{ medianMs([&] { normalizeMinMax(src, result, 0, 255, CV_8U, mask); }) };
+
+		std::cout << std::left << std::setw(26) << "16UC1 -> 8U, mask" << std::right << std::setw(12) << chainMs
+			<< std::setw(14) << "" << std::setw(10) << "" << std::setw(14) << fusedMs << std::setw(9) << chainMs / fusedMs << "x"
+			<< std::setw(12) << cv::norm(expected, result, cv::NORM_INF) << std::endl;
+	}
+
+	return 0;
+}